@@ -15,6 +15,8 @@
 // You should have received a copy of the GNU General Public License
 // along with c45b.  If not, see <http://www.gnu.org/licenses/>.
 
+#include <QStandardPaths>
+
 #include "c45butils.h"
 
 QString FormatControlChars(QString s)
@@ -30,3 +32,8 @@ QString FormatControlChars(QString s)
     }
     return r;
 }
+
+QString CacheDirectory()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + "/c45b";
+}
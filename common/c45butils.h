@@ -18,3 +18,6 @@
 #include <QString>
 
 extern QString FormatControlChars(QString s);
+
+/// Return the directory where c45b keeps state about devices.
+extern QString CacheDirectory();
@@ -0,0 +1,141 @@
+// Copyright 2012 Torsten Martinsen <bullestock@bullestock.net>
+
+// This file is part of c45b.
+
+// c45b is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// c45b is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with c45b.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFileInfo>
+#include <QTextStream>
+
+#include "c45butils.h"
+#include "checkpoint.h"
+#include "hexfile.h"
+
+// First line of a checkpoint file
+static const char* Signature = "c45b checkpoint 1";
+
+FlashCheckpoint::FlashCheckpoint(const QString& port, const HexFile& image, int pageSize)
+    : m_image(image),
+      m_pageSize(pageSize),
+      m_port(port),
+      m_lastPage(-1)
+{
+    const QByteArray key = QCryptographicHash::hash(port.toUtf8(), QCryptographicHash::Sha1).toHex();
+    m_file.setFileName(CacheDirectory() + "/" + QString::fromLatin1(key) + ".resume");
+
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    const HexFile::Ranges& ranges = image.ranges();
+    for (HexFile::Ranges::const_iterator it = ranges.constBegin(); it != ranges.constEnd(); ++it)
+    {
+        const quint32 address = it.key();
+        hash.addData(reinterpret_cast<const char*>(&address), sizeof(address));
+        hash.addData(it.value());
+    }
+    m_imageHash = hash.result().toHex();
+}
+
+FlashCheckpoint::~FlashCheckpoint()
+{
+}
+
+bool FlashCheckpoint::load()
+{
+    m_lastPage = -1;
+    QFile f(m_file.fileName());
+    if (!f.open(QIODevice::ReadOnly | QIODevice::Text))
+    {
+        m_lastError = "No checkpoint for this port";
+        return false;
+    }
+    QTextStream in(&f);
+    if ((in.readLine() != Signature) || (in.readLine() != m_port))
+    {
+        m_lastError = "Checkpoint has the wrong format";
+        return false;
+    }
+    if ((in.readLine() != QString::fromLatin1(m_imageHash)) ||
+        (in.readLine() != QString("pagesize %1").arg(m_pageSize)))
+    {
+        m_lastError = "Checkpoint was made for another image";
+        return false;
+    }
+    bool ok = false;
+    const quint32 page = in.readLine().trimmed().toUInt(&ok, 16);
+    if (!ok || (page % m_pageSize))
+    {
+        m_lastError = "Checkpoint is corrupt";
+        return false;
+    }
+    m_lastPage = page;
+    return true;
+}
+
+QSet<quint32> FlashCheckpoint::committedPages() const
+{
+    QSet<quint32> pages;
+    if (m_lastPage < 0)
+        return pages;
+    // Pages are sent in ascending order
+    const HexFile::Ranges& ranges = m_image.ranges();
+    for (HexFile::Ranges::const_iterator it = ranges.constBegin(); it != ranges.constEnd(); ++it)
+    {
+        const quint32 end = it.key() + it.value().size();
+        for (quint32 page = it.key()/m_pageSize*m_pageSize; (page < end) && (page <= m_lastPage); page += m_pageSize)
+            pages.insert(page);
+    }
+    return pages;
+}
+
+bool FlashCheckpoint::begin()
+{
+    QDir().mkpath(QFileInfo(m_file.fileName()).absolutePath());
+    // Keep an existing checkpoint until a page has been committed, in case this run fails early
+    if (!m_file.open(QIODevice::ReadWrite | QIODevice::Text))
+    {
+        m_lastError = QString("Cannot write '%1': %2").arg(m_file.fileName()).arg(m_file.errorString());
+        return false;
+    }
+    return true;
+}
+
+void FlashCheckpoint::finish()
+{
+    m_file.close();
+    m_file.remove();
+}
+
+void FlashCheckpoint::recordAcknowledged(const FlashPlan& plan, int i, char reply)
+{
+    // Only the bootloader's word that it wrote the page counts. A '*' elsewhere means
+    // its pages are not laid out like ours, and a '.' that it has not written anything.
+    const FlashPlan::Record& r = plan.record(i);
+    if (r.endsPage && (reply == '*'))
+        save((r.address + r.byteCount - 1)/m_pageSize*m_pageSize);
+}
+
+void FlashCheckpoint::save(quint32 address)
+{
+    if (!m_file.isOpen())
+        return;
+    m_lastPage = address;
+    // Fixed length, so it can be rewritten in place
+    const QString text = QString("%1\n%2\n%3\npagesize %4\n%5\n")
+                         .arg(Signature).arg(m_port).arg(QString::fromLatin1(m_imageHash))
+                         .arg(m_pageSize).arg(address, 8, 16, QChar('0'));
+    m_file.seek(0);
+    m_file.write(text.toUtf8());
+    m_file.flush();
+}
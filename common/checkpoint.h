@@ -0,0 +1,73 @@
+// Copyright 2012 Torsten Martinsen <bullestock@bullestock.net>
+
+// This file is part of c45b.
+
+// c45b is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// c45b is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with c45b.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef c45b_checkpoint_h
+#define c45b_checkpoint_h
+
+#include <QByteArray>
+#include <QFile>
+#include <QSet>
+#include <QString>
+
+#include "serport.h"
+
+class HexFile;
+
+/// Remembers how far a flash download got, so an interrupted download can be resumed.
+/// The checkpoint holds a hash of the image and the address of the last page the
+/// bootloader has confirmed writing. It is updated on disk as each page is committed.
+class FlashCheckpoint : public DownloadObserver
+{
+public:
+    /// port: Name of the port the device is connected to
+    FlashCheckpoint(const QString& port, const HexFile& image, int pageSize);
+
+    ~FlashCheckpoint();
+
+    /// Load the checkpoint for the port. Return false if there is none, or if it was
+    /// made for another image or page size.
+    bool load();
+
+    /// Return the start addresses of the pages of the image that were committed
+    /// according to the loaded checkpoint.
+    QSet<quint32> committedPages() const;
+
+    /// Start recording a new download.
+    bool begin();
+
+    /// Delete the checkpoint after a successful download.
+    void finish();
+
+    virtual void recordAcknowledged(const FlashPlan& plan, int i, char reply);
+
+    QString errorString() const { return m_lastError; }
+
+private:
+    /// Write the checkpoint for the page starting at address.
+    void save(quint32 address);
+
+    const HexFile& m_image;
+    int m_pageSize;
+    QString m_port;
+    QByteArray m_imageHash;
+    /// -1 if no page has been committed
+    qint64 m_lastPage;
+    QFile m_file;
+    QString m_lastError;
+};
+
+#endif
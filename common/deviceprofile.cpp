@@ -0,0 +1,151 @@
+// Copyright 2012 Torsten Martinsen <bullestock@bullestock.net>
+
+// This file is part of c45b.
+
+// c45b is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// c45b is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with c45b.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <QFile>
+#include <QSettings>
+
+#include "deviceprofile.h"
+
+namespace
+{
+
+struct BuiltinProfile
+{
+    const char* name;
+    quint32 flashBytes;
+    int pageSize;
+    quint32 eepromBytes;
+};
+
+// Parts supported by chip45boot2
+const BuiltinProfile builtinProfiles[] =
+{
+    { "atmega8",      8192,  64,  512 },
+    { "atmega88",     8192,  64,  512 },
+    { "atmega88p",    8192,  64,  512 },
+    { "atmega16",    16384, 128,  512 },
+    { "atmega168",   16384, 128,  512 },
+    { "atmega168p",  16384, 128,  512 },
+    { "atmega32",    32768, 128, 1024 },
+    { "atmega328p",  32768, 128, 1024 },
+    { "atmega64",    65536, 256, 2048 },
+    { "atmega644p",  65536, 256, 2048 },
+    { "atmega128",  131072, 256, 4096 },
+    { "atmega1280", 131072, 256, 4096 },
+    { "atmega1281", 131072, 256, 4096 },
+    { "atmega1284p",131072, 256, 4096 },
+    { "atmega2560", 262144, 256, 4096 },
+    { "atmega2561", 262144, 256, 4096 }
+};
+
+// chip45boot2 occupies the top 2 KB of flash
+const quint32 BootloaderBytes = 2048;
+
+const int DefaultMaxBaud = 115200;
+
+// Worst case page erase plus write time from the data sheets
+const int DefaultPageWriteUs = 9000;
+
+}
+
+DeviceProfiles::DeviceProfiles()
+{
+    for (unsigned int i = 0; i < sizeof(builtinProfiles)/sizeof(builtinProfiles[0]); ++i)
+    {
+        const BuiltinProfile& b = builtinProfiles[i];
+        DeviceProfile p;
+        p.name = b.name;
+        p.flashBytes = b.flashBytes;
+        p.pageSize = b.pageSize;
+        p.bootStart = b.flashBytes - BootloaderBytes;
+        p.eepromBytes = b.eepromBytes;
+        p.maxBaud = DefaultMaxBaud;
+        p.pageWriteUs = DefaultPageWriteUs;
+        m_profiles.append(p);
+    }
+}
+
+bool DeviceProfiles::load(const QString& fileName)
+{
+    if (!QFile::exists(fileName))
+    {
+        m_lastError = QString("File '%1' not found").arg(fileName);
+        return false;
+    }
+    QSettings settings(fileName, QSettings::IniFormat);
+    if (settings.status() != QSettings::NoError)
+    {
+        m_lastError = QString("Cannot parse '%1'").arg(fileName);
+        return false;
+    }
+    foreach (const QString& name, settings.childGroups())
+    {
+        settings.beginGroup(name);
+        DeviceProfile p;
+        p.name = name.toLower();
+        bool ok[6];
+        p.flashBytes = settings.value("flash").toUInt(&ok[0]);
+        p.pageSize = settings.value("pagesize").toInt(&ok[1]);
+        p.bootStart = settings.value("bootstart", p.flashBytes - BootloaderBytes).toUInt(&ok[2]);
+        p.eepromBytes = settings.value("eeprom").toUInt(&ok[3]);
+        p.maxBaud = settings.value("maxbaud", DefaultMaxBaud).toInt(&ok[4]);
+        p.pageWriteUs = settings.value("pagewrite", DefaultPageWriteUs).toInt(&ok[5]);
+        settings.endGroup();
+        for (int i = 0; i < 6; ++i)
+            if (!ok[i])
+            {
+                m_lastError = QString("Missing or invalid value for part '%1'").arg(name);
+                return false;
+            }
+        if ((p.pageSize <= 0) || (p.pageSize & (p.pageSize - 1)) ||
+            (p.bootStart > p.flashBytes) || (p.flashBytes > 0x1000000))
+        {
+            m_lastError = QString("Inconsistent profile for part '%1'").arg(name);
+            return false;
+        }
+        add(p);
+    }
+    return true;
+}
+
+void DeviceProfiles::add(const DeviceProfile& profile)
+{
+    for (int i = 0; i < m_profiles.size(); ++i)
+        if (m_profiles[i].name == profile.name)
+        {
+            m_profiles[i] = profile;
+            return;
+        }
+    m_profiles.append(profile);
+}
+
+const DeviceProfile* DeviceProfiles::find(const QString& name) const
+{
+    const QString lower = name.toLower();
+    for (int i = 0; i < m_profiles.size(); ++i)
+        if (m_profiles[i].name == lower)
+            return &m_profiles[i];
+    return 0;
+}
+
+QStringList DeviceProfiles::names() const
+{
+    QStringList result;
+    foreach (const DeviceProfile& p, m_profiles)
+        result.append(p.name);
+    return result;
+}
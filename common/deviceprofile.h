@@ -0,0 +1,84 @@
+// Copyright 2012 Torsten Martinsen <bullestock@bullestock.net>
+
+// This file is part of c45b.
+
+// c45b is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// c45b is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with c45b.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef c45b_deviceprofile_h
+#define c45b_deviceprofile_h
+
+#include <QList>
+#include <QString>
+#include <QStringList>
+
+/// Memory layout and timing of a target device.
+struct DeviceProfile
+{
+    DeviceProfile()
+        : flashBytes(0),
+          pageSize(0),
+          bootStart(0),
+          eepromBytes(0),
+          maxBaud(0),
+          pageWriteUs(0)
+    {
+    }
+
+    /// Part name, e.g. "atmega328p"
+    QString name;
+    quint32 flashBytes;
+    /// Flash page size in bytes
+    int pageSize;
+    /// Start of the bootloader section; the application must end below this
+    quint32 bootStart;
+    quint32 eepromBytes;
+    /// Highest baud rate known to work reliably
+    int maxBaud;
+    /// Typical time (in us) to erase and write a flash page
+    int pageWriteUs;
+};
+
+/// Table of device profiles. A built-in table can be extended or overridden from a file.
+class DeviceProfiles
+{
+public:
+    /// Create a table holding the built-in profiles.
+    DeviceProfiles();
+
+    /// Add the profiles in an INI file with one group per part:
+    ///   [atmega328p]
+    ///   flash=32768
+    ///   pagesize=128
+    ///   bootstart=30720
+    ///   eeprom=1024
+    ///   maxbaud=115200
+    ///   pagewrite=4500
+    /// Profiles with the same name as an existing one replace it.
+    bool load(const QString& fileName);
+
+    /// Return the profile for the named part (case insensitive), or 0 if not found.
+    const DeviceProfile* find(const QString& name) const;
+
+    QStringList names() const;
+
+    QString errorString() const { return m_lastError; }
+
+private:
+    void add(const DeviceProfile& profile);
+
+    QList<DeviceProfile> m_profiles;
+    QString m_lastError;
+};
+
+#endif
@@ -0,0 +1,89 @@
+// Copyright 2012 Torsten Martinsen <bullestock@bullestock.net>
+
+// This file is part of c45b.
+
+// c45b is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// c45b is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with c45b.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "flashplan.h"
+#include "hexcodec.h"
+#include "hexfile.h"
+#include "hexutils.h"
+
+FlashPlan::FlashPlan()
+    : m_pageCount(0),
+      m_byteCount(0)
+{
+}
+
+FlashPlan::FlashPlan(const HexFile& hexFile, const QList<HexChunk>& chunks)
+    : m_pageCount(0),
+      m_byteCount(0)
+{
+    // Each record takes 12 characters plus two per data byte, and there can be
+    // a segment record for each data record
+    int maxSize = EndOfFileRecordChars;
+    foreach (const HexChunk& chunk, chunks)
+        maxSize += 12 + 2*chunk.length + SegmentRecordChars;
+    m_data.resize(maxSize);
+    m_records.reserve(2*chunks.size() + 1);
+
+    char* buffer = m_data.data();
+    int size = 0;
+    quint32 segment = 0;
+    foreach (const HexChunk& chunk, chunks)
+    {
+        if ((chunk.address >> 16) != segment)
+        {
+            segment = chunk.address >> 16;
+            const Record r = { size, encodeSegmentRecord(buffer + size, chunk.address),
+                               segment << 16, 0, ExtendedSegment, false };
+            m_records.append(r);
+            size += r.length;
+        }
+        const QByteArray bytes = hexFile.data(chunk.address, chunk.length);
+        const Record r = { size, HexCodec::encodeRecord(buffer + size, Data, chunk.address & 0xFFFF,
+                                                        reinterpret_cast<const quint8*>(bytes.constData()), chunk.length),
+                           chunk.address, static_cast<int>(chunk.length), Data, chunk.endsPage };
+        m_records.append(r);
+        size += r.length;
+        m_byteCount += chunk.length;
+        if (chunk.endsPage)
+            ++m_pageCount;
+    }
+
+    const Record r = { size, encodeEndOfFileRecord(buffer + size), 0, 0, EndOfFile, false };
+    m_records.append(r);
+    size += r.length;
+
+    m_data.resize(size);
+    m_data.squeeze();
+}
+
+int FlashPlan::segmentRecord(int i) const
+{
+    for (; i >= 0; --i)
+        if (m_records.at(i).type == ExtendedSegment)
+            return i;
+    return -1;
+}
+
+int FlashPlan::pageStart(int i) const
+{
+    if (!m_pageCount)
+        return i;
+    // Pages are sent whole, so a page starts after the record that ended the previous one
+    while ((i > 0) && (m_records.at(i-1).type == Data) && !m_records.at(i-1).endsPage)
+        --i;
+    return i;
+}
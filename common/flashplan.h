@@ -0,0 +1,100 @@
+// Copyright 2012 Torsten Martinsen <bullestock@bullestock.net>
+
+// This file is part of c45b.
+
+// c45b is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// c45b is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with c45b.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef c45b_flashplan_h
+#define c45b_flashplan_h
+
+#include <QByteArray>
+#include <QList>
+#include <QVector>
+
+#include "hexchunker.h"
+
+class HexFile;
+
+/// The hex records for an image, encoded exactly as they are sent to the bootloader.
+/// A plan is built once and never modified. All records live in one Latin-1 buffer,
+/// indexed by record. Copies share the same data, so a plan can be used by several
+/// sessions (and threads) at once.
+class FlashPlan
+{
+public:
+    enum RecordType
+    {
+        Data = 0,
+        EndOfFile = 1,
+        ExtendedSegment = 2
+    };
+
+    struct Record
+    {
+        /// Position of the record in data()
+        int offset;
+        /// Length of the record in characters, including the trailing newline
+        int length;
+        /// Address of the first data byte (for ExtendedSegment: start of the segment)
+        quint32 address;
+        /// Number of data bytes
+        int byteCount;
+        RecordType type;
+        /// True if the bootloader writes a page when it receives this record
+        bool endsPage;
+    };
+
+    /// Create an empty plan.
+    FlashPlan();
+
+    /// Encode chunks of hexFile, followed by an end of file record.
+    FlashPlan(const HexFile& hexFile, const QList<HexChunk>& chunks);
+
+    /// Return the encoded records.
+    const QByteArray& data() const { return m_data; }
+
+    int recordCount() const { return m_records.size(); }
+
+    const Record& record(int i) const { return m_records.at(i); }
+
+    /// Return the text of record i.
+    const char* text(int i) const { return m_data.constData() + m_records.at(i).offset; }
+
+    /// Return the reply that acknowledges record i: '*' if it completes a page, otherwise '.'.
+    /// Without page alignment the bootloader decides when to write, so '*' can also arrive
+    /// for records where '.' is expected.
+    char expectedReply(int i) const { return m_records.at(i).endsPage ? '*' : '.'; }
+
+    /// Return the index of the extended segment record in effect for record i, or -1 if none.
+    int segmentRecord(int i) const;
+
+    /// Return the index of the first record on the page that holds record i. This is
+    /// where a resend must start, as the bootloader fills a page it starts afresh with
+    /// 0xFF. Without pages, every record stands alone.
+    int pageStart(int i) const;
+
+    /// Return the number of records that complete a page.
+    int pageCount() const { return m_pageCount; }
+
+    /// Return the number of data bytes in the plan.
+    quint32 byteCount() const { return m_byteCount; }
+
+private:
+    QByteArray m_data;
+    QVector<Record> m_records;
+    int m_pageCount;
+    quint32 m_byteCount;
+};
+
+#endif
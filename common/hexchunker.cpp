@@ -0,0 +1,109 @@
+// Copyright 2012 Torsten Martinsen <bullestock@bullestock.net>
+
+// This file is part of c45b.
+
+// c45b is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// c45b is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with c45b.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <QPair>
+
+#include "hexchunker.h"
+#include "hexfile.h"
+
+HexChunker::HexChunker(int recordBytes, int pageSize)
+    : m_recordBytes(qBound(1, recordBytes, static_cast<int>(HexFile::MaxRecordBytes))),
+      m_pageSize(qMax(pageSize, 0)),
+      m_skipErased(false)
+{
+}
+
+QList<HexChunk> HexChunker::chunk(const HexFile& hexFile, ChunkStats* stats) const
+{
+    // Work out which spans to send: the populated ranges, extended to whole pages if paging
+    QList<QPair<quint32, quint32> > spans;
+    const HexFile::Ranges& ranges = hexFile.ranges();
+    for (HexFile::Ranges::const_iterator it = ranges.constBegin(); it != ranges.constEnd(); ++it)
+    {
+        quint32 start = it.key();
+        quint32 end = start + it.value().size();
+        if (m_pageSize > 0)
+        {
+            start = start/m_pageSize*m_pageSize;
+            end = (end + m_pageSize - 1)/m_pageSize*m_pageSize;
+        }
+        if (!spans.isEmpty() && (spans.last().second >= start))
+            // Shares a page with the previous range
+            spans.last().second = qMax(spans.last().second, end);
+        else
+            spans.append(qMakePair(start, end));
+    }
+
+    QList<HexChunk> chunks;
+    for (int i = 0; i < spans.size(); ++i)
+    {
+        quint32 address = spans[i].first;
+        const quint32 end = spans[i].second;
+        while (address < end)
+        {
+            if (m_skipErased && (m_pageSize > 0) && (address % m_pageSize == 0) && isErased(hexFile, address))
+            {
+                if (stats)
+                {
+                    ++stats->skippedPages;
+                    stats->skippedBytes += m_pageSize;
+                }
+                address += m_pageSize;
+                continue;
+            }
+            if ((m_pageSize > 0) && (address % m_pageSize == 0) && m_unchangedPages.contains(address))
+            {
+                if (stats)
+                {
+                    ++stats->unchangedPages;
+                    stats->unchangedBytes += m_pageSize;
+                }
+                address += m_pageSize;
+                continue;
+            }
+
+            // Stop at the end of the segment...
+            quint32 limit = qMin(end, (address | 0xFFFF) + 1);
+            // ...and at the end of the page
+            if (m_pageSize > 0)
+                limit = qMin(limit, (address/m_pageSize + 1)*m_pageSize);
+
+            HexChunk c;
+            c.address = address;
+            c.length = qMin(address + m_recordBytes, limit) - address;
+            c.endsPage = (m_pageSize > 0) && ((address + c.length) % m_pageSize == 0);
+            chunks.append(c);
+            address += c.length;
+        }
+    }
+    return chunks;
+}
+
+bool HexChunker::isErased(const HexFile& hexFile, quint32 address) const
+{
+    const QByteArray page = hexFile.data(address, m_pageSize);
+    return page.count(static_cast<char>(0xFF)) == page.size();
+}
+
+int HexChunker::pageCount(const QList<HexChunk>& chunks)
+{
+    int pages = 0;
+    foreach (const HexChunk& c, chunks)
+        if (c.endsPage)
+            ++pages;
+    return pages;
+}
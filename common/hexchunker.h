@@ -0,0 +1,81 @@
+// Copyright 2012 Torsten Martinsen <bullestock@bullestock.net>
+
+// This file is part of c45b.
+
+// c45b is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// c45b is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with c45b.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef c45b_hexchunker_h
+#define c45b_hexchunker_h
+
+#include <QList>
+#include <QSet>
+
+class HexFile;
+
+/// A run of image bytes to be sent as one data record.
+struct HexChunk
+{
+    HexChunk() : address(0), length(0), endsPage(false) {}
+
+    quint32 address;
+    quint32 length;
+    /// True if this record completes a flash page
+    bool endsPage;
+};
+
+/// Statistics from HexChunker::chunk().
+struct ChunkStats
+{
+    ChunkStats() : skippedPages(0), skippedBytes(0), unchangedPages(0), unchangedBytes(0) {}
+
+    /// Erased pages left out
+    int skippedPages;
+    quint32 skippedBytes;
+    /// Pages left out because the device already holds them
+    int unchangedPages;
+    quint32 unchangedBytes;
+};
+
+/// Splits an image into data records.
+/// Records never cross a 64 KB segment boundary. If a page size is given, records are
+/// also laid out on page boundaries, and a partial last page is padded to a full page.
+class HexChunker
+{
+public:
+    /// pageSize: Size of a flash page in bytes, or 0 for no paging
+    HexChunker(int recordBytes, int pageSize = 0);
+
+    QList<HexChunk> chunk(const HexFile& hexFile, ChunkStats* stats = 0) const;
+
+    int pageSize() const { return m_pageSize; }
+
+    /// Leave out pages where every byte is 0xFF (requires a page size).
+    void setSkipErased(bool skip) { m_skipErased = skip; }
+
+    /// Leave out the pages starting at these addresses (requires a page size).
+    void setUnchangedPages(const QSet<quint32>& pages) { m_unchangedPages = pages; }
+
+    /// Return the number of page commits in chunks.
+    static int pageCount(const QList<HexChunk>& chunks);
+
+private:
+    bool isErased(const HexFile& hexFile, quint32 address) const;
+
+    int m_recordBytes;
+    int m_pageSize;
+    bool m_skipErased;
+    QSet<quint32> m_unchangedPages;
+};
+
+#endif
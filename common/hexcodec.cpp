@@ -0,0 +1,395 @@
+// Copyright 2012 Torsten Martinsen <bullestock@bullestock.net>
+
+// This file is part of c45b.
+
+// c45b is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// c45b is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with c45b.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "hexcodec.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#  define C45B_X86
+#  include <emmintrin.h>
+#  include <immintrin.h>
+#  ifdef _MSC_VER
+#    include <intrin.h>
+#  endif
+#endif
+
+#if defined(__GNUC__)
+#  define C45B_TARGET(t) __attribute__((target(t)))
+#else
+#  define C45B_TARGET(t)
+#endif
+
+#ifdef _MSC_VER
+#  define C45B_CTZ(x) _tzcnt_u32(x)
+#else
+#  define C45B_CTZ(x) __builtin_ctz(x)
+#endif
+
+namespace
+{
+
+const char digits[] = "0123456789abcdef";
+
+// Value of each hex digit, or -1
+struct DecodeTable
+{
+    DecodeTable()
+    {
+        for (int i = 0; i < 256; ++i)
+            value[i] = -1;
+        for (int i = 0; i < 10; ++i)
+            value['0' + i] = i;
+        for (int i = 0; i < 6; ++i)
+        {
+            value['a' + i] = 10 + i;
+            value['A' + i] = 10 + i;
+        }
+    }
+
+    signed char value[256];
+};
+
+const DecodeTable decodeTable;
+
+int decodeScalar(const char* src, int count, quint8* dst, quint8& checksum)
+{
+    quint8 sum = checksum;
+    for (int i = 0; i < count; ++i)
+    {
+        const int high = decodeTable.value[static_cast<unsigned char>(src[2*i])];
+        const int low = decodeTable.value[static_cast<unsigned char>(src[2*i+1])];
+        if ((high | low) < 0)
+            return (high < 0) ? 2*i : 2*i+1;
+        dst[i] = (high << 4) | low;
+        sum += dst[i];
+    }
+    checksum = sum;
+    return -1;
+}
+
+void encodeScalar(const quint8* src, int count, char* dst, quint8& checksum)
+{
+    quint8 sum = checksum;
+    for (int i = 0; i < count; ++i)
+    {
+        dst[2*i] = digits[src[i] >> 4];
+        dst[2*i+1] = digits[src[i] & 0xF];
+        sum += src[i];
+    }
+    checksum = sum;
+}
+
+#ifdef C45B_X86
+
+// Convert 16 characters to nibble values. Set invalid to a bit mask of invalid characters.
+C45B_TARGET("sse2")
+inline __m128i nibblesSse2(__m128i c, int& invalid)
+{
+    // Folding in 0x20 maps 'A'-'F' to 'a'-'f' and leaves '0'-'9' unchanged
+    const __m128i lower = _mm_or_si128(c, _mm_set1_epi8(0x20));
+    const __m128i isDigit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)),
+                                          _mm_cmplt_epi8(c, _mm_set1_epi8('9' + 1)));
+    const __m128i isLetter = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                                           _mm_cmplt_epi8(lower, _mm_set1_epi8('f' + 1)));
+    invalid = ~_mm_movemask_epi8(_mm_or_si128(isDigit, isLetter)) & 0xFFFF;
+    return _mm_or_si128(_mm_and_si128(isDigit, _mm_sub_epi8(c, _mm_set1_epi8('0'))),
+                        _mm_and_si128(isLetter, _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10))));
+}
+
+// Convert 16 nibble values to lower case hex digits
+C45B_TARGET("sse2")
+inline __m128i digitsSse2(__m128i n)
+{
+    const __m128i letter = _mm_and_si128(_mm_cmpgt_epi8(n, _mm_set1_epi8(9)), _mm_set1_epi8('a' - '0' - 10));
+    return _mm_add_epi8(_mm_add_epi8(n, _mm_set1_epi8('0')), letter);
+}
+
+C45B_TARGET("sse2")
+int decodeSse2(const char* src, int count, quint8* dst, quint8& checksum)
+{
+    quint8 sum = checksum;
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        int invalid = 0;
+        const __m128i n = nibblesSse2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2*i)), invalid);
+        if (invalid)
+            return 2*i + C45B_CTZ(invalid);
+        // Each 16 bit lane holds the high nibble in its low byte and the low nibble in its high byte
+        const __m128i bytes = _mm_and_si128(_mm_or_si128(_mm_slli_epi16(n, 4), _mm_srli_epi16(n, 8)),
+                                            _mm_set1_epi16(0xFF));
+        const __m128i packed = _mm_packus_epi16(bytes, bytes);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + i), packed);
+        const __m128i sad = _mm_sad_epu8(bytes, _mm_setzero_si128());
+        sum += static_cast<quint8>(_mm_cvtsi128_si32(sad) + _mm_extract_epi16(sad, 4));
+    }
+    quint8 tailSum = sum;
+    const int bad = decodeScalar(src + 2*i, count - i, dst + i, tailSum);
+    if (bad >= 0)
+        return 2*i + bad;
+    checksum = tailSum;
+    return -1;
+}
+
+C45B_TARGET("sse2")
+void encodeSse2(const quint8* src, int count, char* dst, quint8& checksum)
+{
+    quint8 sum = checksum;
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        const __m128i b = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i));
+        const __m128i high = _mm_and_si128(_mm_srli_epi16(b, 4), _mm_set1_epi8(0xF));
+        const __m128i low = _mm_and_si128(b, _mm_set1_epi8(0xF));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 2*i), digitsSse2(_mm_unpacklo_epi8(high, low)));
+        sum += static_cast<quint8>(_mm_cvtsi128_si32(_mm_sad_epu8(b, _mm_setzero_si128())));
+    }
+    encodeScalar(src + i, count - i, dst + 2*i, sum);
+    checksum = sum;
+}
+
+C45B_TARGET("avx2")
+int decodeAvx2(const char* src, int count, quint8* dst, quint8& checksum)
+{
+    quint8 sum = checksum;
+    int i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        const __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 2*i));
+        const __m256i lower = _mm256_or_si256(c, _mm256_set1_epi8(0x20));
+        const __m256i isDigit = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('0' - 1)),
+                                                 _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), c));
+        const __m256i isLetter = _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)),
+                                                  _mm256_cmpgt_epi8(_mm256_set1_epi8('f' + 1), lower));
+        const unsigned invalid = ~static_cast<unsigned>(_mm256_movemask_epi8(_mm256_or_si256(isDigit, isLetter)));
+        if (invalid)
+            return 2*i + C45B_CTZ(invalid);
+        const __m256i n = _mm256_or_si256(_mm256_and_si256(isDigit, _mm256_sub_epi8(c, _mm256_set1_epi8('0'))),
+                                          _mm256_and_si256(isLetter, _mm256_sub_epi8(lower, _mm256_set1_epi8('a' - 10))));
+        const __m256i bytes = _mm256_and_si256(_mm256_or_si256(_mm256_slli_epi16(n, 4), _mm256_srli_epi16(n, 8)),
+                                               _mm256_set1_epi16(0xFF));
+        // Packing works per 128 bit lane, so gather the two low quadwords
+        const __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(bytes, bytes), 0x08);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm256_castsi256_si128(packed));
+        const __m256i sad256 = _mm256_sad_epu8(bytes, _mm256_setzero_si256());
+        const __m128i sad = _mm_add_epi64(_mm256_castsi256_si128(sad256), _mm256_extracti128_si256(sad256, 1));
+        sum += static_cast<quint8>(_mm_cvtsi128_si32(sad) + _mm_extract_epi16(sad, 4));
+    }
+    quint8 tailSum = sum;
+    const int bad = decodeSse2(src + 2*i, count - i, dst + i, tailSum);
+    if (bad >= 0)
+        return 2*i + bad;
+    checksum = tailSum;
+    return -1;
+}
+
+C45B_TARGET("avx2")
+void encodeAvx2(const quint8* src, int count, char* dst, quint8& checksum)
+{
+    quint8 sum = checksum;
+    int i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        const __m128i high = _mm_and_si128(_mm_srli_epi16(b, 4), _mm_set1_epi8(0xF));
+        const __m128i low = _mm_and_si128(b, _mm_set1_epi8(0xF));
+        const __m256i n = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi8(high, low)),
+                                                  _mm_unpackhi_epi8(high, low), 1);
+        const __m256i letter = _mm256_and_si256(_mm256_cmpgt_epi8(n, _mm256_set1_epi8(9)),
+                                                _mm256_set1_epi8('a' - '0' - 10));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 2*i),
+                            _mm256_add_epi8(_mm256_add_epi8(n, _mm256_set1_epi8('0')), letter));
+        const __m128i sad = _mm_sad_epu8(b, _mm_setzero_si128());
+        sum += static_cast<quint8>(_mm_cvtsi128_si32(sad) + _mm_extract_epi16(sad, 4));
+    }
+    encodeSse2(src + i, count - i, dst + 2*i, sum);
+    checksum = sum;
+}
+
+bool cpuHasAvx2()
+{
+#if defined(__GNUC__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#elif defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+    __cpuid(info, 1);
+    // OSXSAVE and AVX
+    if ((info[2] & 0x18000000) != 0x18000000)
+        return false;
+    if ((_xgetbv(0) & 6) != 6)
+        return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & 0x20) != 0;
+#else
+    return false;
+#endif
+}
+
+bool cpuHasSse2()
+{
+#if defined(__x86_64__) || defined(_M_X64)
+    return true;
+#elif defined(__GNUC__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+#else
+    return false;
+#endif
+}
+
+#endif // C45B_X86
+
+typedef int (*DecodeFunc)(const char*, int, quint8*, quint8&);
+typedef void (*EncodeFunc)(const quint8*, int, char*, quint8&);
+
+struct Implementation
+{
+    HexCodec::Kind kind;
+    DecodeFunc decode;
+    EncodeFunc encode;
+};
+
+bool lookup(HexCodec::Kind kind, Implementation& impl)
+{
+    impl.kind = kind;
+    switch (kind)
+    {
+    case HexCodec::Scalar:
+        impl.decode = decodeScalar;
+        impl.encode = encodeScalar;
+        return true;
+
+#ifdef C45B_X86
+    case HexCodec::Sse2:
+        impl.decode = decodeSse2;
+        impl.encode = encodeSse2;
+        return cpuHasSse2();
+
+    case HexCodec::Avx2:
+        impl.decode = decodeAvx2;
+        impl.encode = encodeAvx2;
+        return cpuHasSse2() && cpuHasAvx2();
+#endif
+
+    default:
+        return false;
+    }
+}
+
+// The implementations the CPU supports, and the fastest of them
+struct Implementations
+{
+    Implementations()
+        : best(HexCodec::Scalar)
+    {
+        const HexCodec::Kind kinds[] = { HexCodec::Scalar, HexCodec::Sse2, HexCodec::Avx2 };
+        for (int i = 0; i < KindCount; ++i)
+        {
+            available[i] = lookup(kinds[i], impl[i]);
+            if (available[i])
+                best = kinds[i];
+        }
+    }
+
+    static const int KindCount = HexCodec::Avx2 + 1;
+    Implementation impl[KindCount];
+    bool available[KindCount];
+    HexCodec::Kind best;
+};
+
+const Implementations& implementations()
+{
+    // Built on first use; initialising a local static is thread safe
+    static const Implementations table;
+    return table;
+}
+
+const Implementation& implementation(HexCodec::Kind kind)
+{
+    return implementations().impl[kind];
+}
+
+} // namespace
+
+namespace HexCodec
+{
+
+Kind current()
+{
+    return implementations().best;
+}
+
+bool available(Kind kind)
+{
+    return (kind >= Scalar) && (kind <= Avx2) && implementations().available[kind];
+}
+
+const char* name(Kind kind)
+{
+    switch (kind)
+    {
+    case Sse2:
+        return "SSE2";
+    case Avx2:
+        return "AVX2";
+    default:
+        return "scalar";
+    }
+}
+
+int decode(const char* src, int count, quint8* dst, quint8& checksum)
+{
+    return implementation(current()).decode(src, count, dst, checksum);
+}
+
+int decode(Kind kind, const char* src, int count, quint8* dst, quint8& checksum)
+{
+    return implementation(kind).decode(src, count, dst, checksum);
+}
+
+void encode(const quint8* src, int count, char* dst, quint8& checksum)
+{
+    implementation(current()).encode(src, count, dst, checksum);
+}
+
+void encode(Kind kind, const quint8* src, int count, char* dst, quint8& checksum)
+{
+    implementation(kind).encode(src, count, dst, checksum);
+}
+
+int encodeRecord(char* dst, quint8 type, quint16 address, const quint8* data, int count)
+{
+    const quint8 header[4] = { static_cast<quint8>(count), static_cast<quint8>(address >> 8),
+                               static_cast<quint8>(address & 0xFF), type };
+    quint8 checksum = 0;
+    char* p = dst;
+    *p++ = ':';
+    encode(header, 4, p, checksum);
+    p += 8;
+    encode(data, count, p, checksum);
+    p += 2*count;
+    checksum = (checksum ^ 0xFF) + 1;
+    *p++ = digits[checksum >> 4];
+    *p++ = digits[checksum & 0xF];
+    *p++ = '\n';
+    return static_cast<int>(p - dst);
+}
+
+}
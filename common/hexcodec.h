@@ -0,0 +1,67 @@
+// Copyright 2012 Torsten Martinsen <bullestock@bullestock.net>
+
+// This file is part of c45b.
+
+// c45b is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// c45b is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with c45b.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef c45b_hexcodec_h
+#define c45b_hexcodec_h
+
+#include <QtGlobal>
+
+/// Hex digit decode/encode kernels.
+/// The fastest implementation supported by the CPU is picked once, on first use, and
+/// never changes afterwards, so the functions can be called from any thread.
+namespace HexCodec
+{
+    enum Kind
+    {
+        Scalar,
+        Sse2,
+        Avx2
+    };
+
+    /// Return the implementation used by decode() and encode().
+    Kind current();
+
+    /// Return true if the CPU supports kind.
+    bool available(Kind kind);
+
+    const char* name(Kind kind);
+
+    /// Decode count pairs of hex digits from src into dst.
+    /// The decoded bytes are added to checksum.
+    /// Return the index (in src) of the first invalid character, or -1 if all are valid.
+    int decode(const char* src, int count, quint8* dst, quint8& checksum);
+
+    /// Like decode(), with the given implementation, which must be available().
+    int decode(Kind kind, const char* src, int count, quint8* dst, quint8& checksum);
+
+    /// Encode count bytes from src as 2*count lower case hex digits in dst.
+    /// The bytes are added to checksum.
+    void encode(const quint8* src, int count, char* dst, quint8& checksum);
+
+    /// Like encode(), with the given implementation, which must be available().
+    void encode(Kind kind, const quint8* src, int count, char* dst, quint8& checksum);
+
+    /// Longest record produced by encodeRecord(), in characters
+    const int MaxRecordChars = 1 + 2*(4 + 255 + 1) + 1;
+
+    /// Encode an Intel HEX record, including the leading ':' and the trailing newline,
+    /// in dst (which must hold at least MaxRecordChars characters).
+    /// Return the number of characters written.
+    int encodeRecord(char* dst, quint8 type, quint16 address, const quint8* data, int count);
+}
+
+#endif
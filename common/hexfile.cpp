@@ -18,10 +18,13 @@
 #include <iostream>
 #include <iomanip>
 
+#include <ctype.h>
+#include <string.h>
+
 #include <QFile>
 
+#include "hexcodec.h"
 #include "hexfile.h"
-#include "hexutils.h"
 
 
 using namespace std;
@@ -29,8 +32,12 @@ using namespace std;
 // Currently the biggest AVR controller has 256k Flash
 const quint32 MAX_FLASH_BYTES = 262144;
 
+const int HexFile::DefaultRecordBytes;
+const int HexFile::MaxRecordBytes;
+
 
 HexFile::HexFile()
+    : m_maxSize(MAX_FLASH_BYTES)
 {
     reset();
 }
@@ -42,40 +49,97 @@ HexFile::~HexFile()
 bool HexFile::load(QString fileName, bool verbose)
 {
     QFile f(fileName);
-    if (!f.open(QIODevice::ReadOnly | QIODevice::Text))
+    if (!f.open(QIODevice::ReadOnly))
     {
         m_lastError = "File not found";
         return false;
     }
     reset();
-    quint16 lineNr = 0;
+    const qint64 size = f.size();
+    if (size <= 0)
+        return true;
+    // Parse the file in place if possible
+    const uchar* mapped = f.map(0, size);
+    if (mapped)
+        return parse(reinterpret_cast<const char*>(mapped), size, verbose);
+    const QByteArray contents = f.readAll();
+    return parse(contents.constData(), contents.size(), verbose);
+}
+
+bool HexFile::parse(const char* text, qint64 size, bool verbose)
+{
+    quint32 lineNr = 0;
     quint32 extendedSegmentAddress = 0;
-    while (!f.atEnd())
+    // Decoded data bytes and checksum of the current record
+    quint8 data[256];
+    qint64 pos = 0;
+    while (pos < size)
     {
         ++lineNr;
-        QByteArray line = f.readLine();
-
-        // grab hexfile information
-        unsigned char byteCount = asciiToHex(line[1], line[2]);  // get number of bytes
-        unsigned char checkSum = byteCount;  // start checksum computation
-        quint32 address = asciiToHex(line[3], line[4]);  // get address high byte
-        checkSum += (unsigned char) address;  // checksum...
-        address = address << 8;
-        unsigned char low = asciiToHex(line[5], line[6]);  // get address low byte
-        address += low;
-        checkSum += (unsigned char) (address & 0xff);  // checksum...
-        unsigned char recordType = asciiToHex(line[7], line[8]);  // get record type
-        checkSum += recordType;
-        unsigned char fileCheckSum = asciiToHex(line[(byteCount*2)+9], line[(byteCount*2)+10]);  // get the checksum
+        const qint64 offset = pos;
+        const char* line = text + pos;
+        const char* newline = static_cast<const char*>(memchr(line, '\n', size - pos));
+        qint64 length = newline ? (newline - line) : (size - pos);
+        pos += length + 1;
+        // Ignore trailing whitespace, including the CR of a CR/LF line ending
+        while ((length > 0) && isspace(static_cast<unsigned char>(line[length-1])))
+            --length;
+        if (!length)
+            continue;
+
+        // A record is ':', byte count, address, type, data and checksum
+        if ((line[0] != ':') || (length < 11))
+        {
+            m_lastError = QString("Malformed record in line %1 (offset %2)").arg(lineNr).arg(offset);
+            return false;
+        }
+
+        // Byte count, address and record type
+        quint8 header[4];
+        quint8 checkSum = 0;
+        int bad = HexCodec::decode(line + 1, 4, header, checkSum);
+        if (bad < 0)
+        {
+            const unsigned char byteCount = header[0];
+            if (length != 11 + 2*byteCount)
+            {
+                m_lastError = QString("Record length mismatch in line %1 (offset %2): Byte count %3, but %4 characters")
+                              .arg(lineNr).arg(offset).arg(byteCount).arg(length);
+                return false;
+            }
+            // Data bytes followed by the checksum, which makes the sum zero
+            bad = HexCodec::decode(line + 9, byteCount + 1, data, checkSum);
+            if (bad >= 0)
+                bad += 8;
+        }
+        if (bad >= 0)
+        {
+            m_lastError = QString("Invalid character in line %1 (offset %2)").arg(lineNr).arg(offset + 1 + bad);
+            return false;
+        }
+        const unsigned char byteCount = header[0];
+        const quint32 address = (header[1] << 8) + header[2];
+        const unsigned char recordType = header[3];
+
+        // check if checksum error
+        if (checkSum != 0)
+        {
+            const quint8 fileCheckSum = data[byteCount];
+            m_lastError = QString("Checksum error in line %1 (offset %2): Expected %3, computed %4")
+                          .arg(lineNr).arg(offset).arg(fileCheckSum).arg(static_cast<quint8>(-(checkSum - fileCheckSum)));
+            return false;
+        }
 
         switch (recordType)
         {
         case 2:
             // extended segment address record
-            extendedSegmentAddress = asciiToHex(line[9], line[10]) << 8;
-            checkSum += (extendedSegmentAddress >> 8);  // chechsum...
-            extendedSegmentAddress += asciiToHex(line[11], line[12]);
-            checkSum += (extendedSegmentAddress & 0xff);  // chechsum...
+            if (byteCount != 2)
+            {
+                m_lastError = QString("Malformed extended address record in line %1 (offset %2)").arg(lineNr).arg(offset);
+                return false;
+            }
+            extendedSegmentAddress = (data[0] << 8) + data[1];
             if(verbose)
             {
                 cout << "Got extended adress record" <<endl;
@@ -87,128 +151,160 @@ bool HexFile::load(QString fileName, bool verbose)
             if (verbose)
             {
                 cout << "Loaded hex file" << endl;
-                cout << "Read " << QByteArray::size() << " bytes" << endl;
+                cout << "Read " << HexFile::byteCount() << " bytes" << endl;
             }
-            break;
+            return true;
 
         case 0:
+            // data record
+            if(!setRange(address + (extendedSegmentAddress * 16), reinterpret_cast<const char*>(data), byteCount))
             {
-                // data record
-                for (unsigned int i = 0; i < (2 * ((unsigned int)byteCount)); i += 2)
-                {
-                    unsigned char dataByte = asciiToHex(line[i+9], line[i+10]);
-                    checkSum += dataByte;  // compute checksum
-                    if(!setByte(address + (extendedSegmentAddress * 16) + (i >> 1), dataByte))
-                    {
-                        m_lastError = QString("Maximum size exceeded");
-                        return false;
-                    }
-                }
-
+                m_lastError = QString("Maximum size exceeded in line %1 (offset %2): %3")
+                              .arg(lineNr).arg(offset).arg(m_lastError);
+                return false;
             }
             break;
+
         default:
             m_lastError = QString("Found unknown or unsupported record type (0x%1)").arg(recordType, 2, 16, QChar('0'));
             return false;
         }
-
-        // check if checksum error
-        if (((checkSum + fileCheckSum) & 0xff) != 0)
-        {
-            m_lastError = QString("Checksum error in line %1: Expected %2, computed %3").arg(lineNr).arg(fileCheckSum).arg(checkSum);
-            return false;
-        }
     }
 
     return true;
 }
 
+static quint32 rangeEnd(HexFile::Ranges::const_iterator it)
+{
+    return it.key() + it.value().size();
+}
+
 bool HexFile::setByte(quint32 address, quint8 data)
 {
-    if (address >= MAX_FLASH_BYTES)
+    return setRange(address, QByteArray(1, data));
+}
+
+bool HexFile::setRange(quint32 address, const QByteArray& data)
+{
+    return setRange(address, data.constData(), data.size());
+}
+
+bool HexFile::setRange(quint32 address, const char* data, int length)
+{
+    if (length <= 0)
+        return true;
+    const quint32 end = address + length;
+    if (end > m_maxSize)
     {
-        m_lastError = QString("Overflow (address %1)").arg(address);
+        m_lastError = QString("Overflow (address %1, limit %2)").arg(end-1).arg(m_maxSize);
         return false;
     }
-    if (address > static_cast<quint32>(QByteArray::size()))
-        QByteArray::append(QByteArray(address - QByteArray::size(), 0));
-    QByteArray::operator[](address) = data;
+
+    // Find the first range that overlaps or touches the new data
+    Ranges::iterator it = m_ranges.upperBound(address);
+    if (it != m_ranges.begin())
+    {
+        Ranges::iterator prev = it;
+        --prev;
+        if (rangeEnd(prev) >= address)
+            it = prev;
+    }
+    if ((it == m_ranges.end()) || (it.key() > end))
+    {
+        m_ranges.insert(address, QByteArray(data, length));
+        return true;
+    }
+
+    // Merge the new data and all ranges it overlaps or touches into one range
+    const quint32 start = qMin(address, it.key());
+    QByteArray merged;
+    while ((it != m_ranges.end()) && (it.key() <= end))
+    {
+        const quint32 offset = it.key() - start;
+        if (merged.isEmpty() && !offset)
+            // Reuse the existing buffer
+            merged = it.value();
+        else
+        {
+            if (static_cast<quint32>(merged.size()) < offset + it.value().size())
+                merged.resize(offset + it.value().size());
+            memcpy(merged.data() + offset, it.value().constData(), it.value().size());
+        }
+        it = m_ranges.erase(it);
+    }
+    if (static_cast<quint32>(merged.size()) < end - start)
+        merged.resize(end - start);
+    memcpy(merged.data() + (address - start), data, length);
+    m_ranges.insert(start, merged);
     return true;
 }
 
 bool HexFile::append(quint8 data)
 {
-    if (static_cast<quint32>(QByteArray::length()) >= MAX_FLASH_BYTES)
-    {
-        m_lastError = QString("Overflow (address %1)").arg(QByteArray::length()+1);
-        return false;
-    }
-    QByteArray::append(data);
-    return true;
+    return setByte(size(), data);
 }
 
 void HexFile::reset()
 {
-    QByteArray::fill(0, MAX_FLASH_BYTES);
-    QByteArray::clear();
+    m_ranges.clear();
 }
 
-bool HexFile::equal(const HexFile& other)
+quint32 HexFile::size() const
 {
-    if (size() != other.size())
-        return false;
-
-    for (int i = 0; i < size(); ++i)
-        if (operator[](i) != other[i])
-            return false;
-    return true;
+    if (m_ranges.isEmpty())
+        return 0;
+    Ranges::const_iterator last = m_ranges.constEnd();
+    --last;
+    return rangeEnd(last);
 }
 
-QStringList HexFile::getHexFile() const
+quint32 HexFile::byteCount() const
 {
-    QStringList result;
-    const QChar zeropad('0');
-    const quint32 byteCount = 16;  // byte count is fixed to 16 bytes
-    const quint32 hexSize = static_cast<quint32>(QByteArray::size());
-
-    int lines = (hexSize+(byteCount-1))/byteCount; // round up
+    quint32 count = 0;
+    for (Ranges::const_iterator it = m_ranges.constBegin(); it != m_ranges.constEnd(); ++it)
+        count += it.value().size();
+    return count;
+}
 
-    for (int line = 0; line < lines; ++line)
-    {
-        quint32 address   = line*byteCount;
-        quint16 addressSh = address;
+bool HexFile::contains(quint32 address) const
+{
+    Ranges::const_iterator it = m_ranges.upperBound(address);
+    if (it == m_ranges.constBegin())
+        return false;
+    --it;
+    return address < rangeEnd(it);
+}
 
-        // preamble
+bool HexFile::equal(const HexFile& other)
+{
+    return m_ranges == other.m_ranges;
+}
 
-        if(    (address>0)                          // new segment
-            && ((address% (0x10000))==0))
-        {
-            quint16 segAddress = address/16;
-            quint8 segChksum = ((2+2+(segAddress >> 8) + (segAddress & 0xFF)) ^ 0xFF) +1;
-            QString segStr = QString(":02000002%1%2\n")
-                                .arg(segAddress, 4, 16, zeropad)
-                                .arg(segChksum, 2, 16, zeropad);
-            result.append(segStr);
+quint8 HexFile::byteAt(quint32 address) const
+{
+    Ranges::const_iterator it = m_ranges.upperBound(address);
+    if (it == m_ranges.constBegin())
+        return 0xFF;
+    --it;
+    if (address >= rangeEnd(it))
+        return 0xFF;
+    return it.value().at(address - it.key());
+}
 
-        }
-        quint32 thisLinesBytecount = (address+byteCount) > hexSize
-                                        ? hexSize-address
-                                        : byteCount;
-        QString str = QString(":%1%2%3").arg(thisLinesBytecount, 2,16, zeropad)
-                                        .arg(addressSh, 4, 16, zeropad)
-                                        .arg(0, 2, 16, zeropad);
-        quint8 checksum = thisLinesBytecount + (addressSh >> 8) + (addressSh & 0xFF);
-        for (quint32 i = 0; i < thisLinesBytecount; ++i)
-        {
-            quint8 byte = QByteArray::operator[](address + i);
-            checksum += byte;
-            str += QString("%1").arg(byte, 2, 16, zeropad);
-        }
-        checksum = (checksum ^ 0xFF)+1;
-        str += QString("%1\n").arg(checksum, 2, 16, zeropad);
-        result.append(str);
+QByteArray HexFile::data(quint32 address, quint32 length) const
+{
+    QByteArray result(length, static_cast<char>(0xFF));
+    const quint32 end = address + length;
+    // Start with the last range beginning at or before address
+    Ranges::const_iterator it = m_ranges.upperBound(address);
+    if (it != m_ranges.constBegin())
+        --it;
+    for (; (it != m_ranges.constEnd()) && (it.key() < end); ++it)
+    {
+        const quint32 from = qMax(address, it.key());
+        const quint32 to = qMin(end, rangeEnd(it));
+        if (from < to)
+            memcpy(result.data() + (from - address), it.value().constData() + (from - it.key()), to - from);
     }
-    result.append(QString(":00000001FF\n"));
-
     return result;
 }
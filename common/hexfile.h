@@ -15,33 +15,77 @@
 // You should have received a copy of the GNU General Public License
 // along with c45b.  If not, see <http://www.gnu.org/licenses/>.
 
+#ifndef c45b_hexfile_h
+#define c45b_hexfile_h
+
 #include <QByteArray>
+#include <QMap>
 #include <QString>
-#include <QStringList>
-
-
 
-class HexFile : QByteArray // TODO: Use composition ISO private inheritance
+/// A memory image, stored as a sorted set of non-adjacent address ranges.
+class HexFile
 {
 public:
+    /// Populated address ranges, keyed by start address
+    typedef QMap<quint32, QByteArray> Ranges;
+
+    /// Number of data bytes per record, unless otherwise specified
+    static const int DefaultRecordBytes = 16;
+
+    /// Largest number of data bytes per record that the chip45boot2 line buffer accepts
+    static const int MaxRecordBytes = 32;
+
     HexFile();
 
     ~HexFile();
 
     void reset();
 
-    QStringList getHexFile() const;
+    /// Reject data at or above this address. The default fits the largest AVR.
+    void setMaxSize(quint32 bytes) { m_maxSize = bytes; }
+
+    quint32 maxSize() const { return m_maxSize; }
+
+    /// Load an Intel HEX file. The file is memory mapped and parsed in place when possible.
     bool load(QString fileName, bool verbose);
 
     QString errorString() const {return m_lastError;}
 
     bool setByte(quint32 address, quint8 data);
+
+    /// Store data at address, overwriting any existing bytes.
+    bool setRange(quint32 address, const QByteArray& data);
+
+    bool setRange(quint32 address, const char* data, int length);
+
+    /// Set the byte following the highest populated address.
     bool append(quint8 data);
 
-    using QByteArray::size;
+    /// Return the highest populated address plus one.
+    quint32 size() const;
+
+    /// Return the number of populated bytes.
+    quint32 byteCount() const;
+
+    bool contains(quint32 address) const;
+
+    /// Return the byte at address. Unpopulated bytes read as erased flash (0xFF).
+    quint8 byteAt(quint32 address) const;
+
+    /// Return length bytes starting at address. Unpopulated bytes read as 0xFF.
+    QByteArray data(quint32 address, quint32 length) const;
+
+    const Ranges& ranges() const { return m_ranges; }
 
     bool equal(const HexFile& other);
 
 private:
+   /// Parse the contents of a hex file.
+   bool parse(const char* text, qint64 size, bool verbose);
+
+   Ranges m_ranges;
+   quint32 m_maxSize;
    QString m_lastError;
 };
+
+#endif
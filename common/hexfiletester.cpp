@@ -16,15 +16,33 @@
 // along with c45b.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <iostream>
+#include <iomanip>
+#include <string.h>
 
+#include <QElapsedTimer>
+#include <QFile>
+#include <QTemporaryDir>
+
+#include "deviceprofile.h"
+#include "flashplan.h"
+#include "hexchunker.h"
+#include "hexcodec.h"
 #include "hexfile.h"
 #include "hexfiletester.h"
 #include "hexutils.h"
+#include "loopbacktransport.h"
+#include "pagecache.h"
+#include "serport.h"
+#include "simbootloader.h"
 
 using namespace std;
 
 void HexFileTester::test(const QString& filename)
 {
+    // test the vectorised codecs against the scalar one
+    if (!testCodecs())
+        return;
+
     HexFile hf;
 
     // test load
@@ -38,6 +56,14 @@ void HexFileTester::test(const QString& filename)
     if (!writeHexfile(filename+"_out2.hex", hf))
         return;
 
+    // test page cache round trip
+    if (!testPageCache(hf))
+        return;
+
+    // test resending after a lost reply
+    if (!testRetry(hf))
+        return;
+
     // test empty file
     hf.reset();
     if (!writeHexfile(filename+"_out3.hex", hf))
@@ -86,3 +112,308 @@ void HexFileTester::test(const QString& filename)
     if (!writeHexfile(filename+"_out7.hex", hf))
         return; // TODO: Complain?
 }
+
+bool HexFileTester::testPageCache(const HexFile& hf)
+{
+    // Keep away from the real cache
+    QTemporaryDir dir;
+    if (!dir.isValid())
+    {
+        cout << "Error: Cannot create a directory for the page cache test" << endl;
+        return false;
+    }
+    // An ID may contain anything, even a line break
+    const QString deviceId("c45b self test\n/dev/ttyUSB0 0123456789");
+    const int pageSize = 128;
+    PageCache written(deviceId, pageSize, dir.path());
+    if (!written.save(hf))
+    {
+        cout << "Error saving page cache: " << written.errorString().toLatin1().constData() << endl;
+        return false;
+    }
+    const int pages = written.unchangedPages(hf).size();
+    if (!pages)
+        return true;
+
+    // Change one byte of the first page
+    HexFile changed = hf;
+    const quint32 address = hf.ranges().constBegin().key();
+    changed.setByte(address, static_cast<quint8>(hf.data(address, 1).at(0)) ^ 0xFF);
+    PageCache read(deviceId, pageSize, dir.path());
+    if (!read.load())
+    {
+        cout << "Error loading page cache: " << read.errorString().toLatin1().constData() << endl;
+        return false;
+    }
+    const QSet<quint32> unchanged = read.unchangedPages(changed);
+    if ((unchanged.size() != pages - 1) || unchanged.contains(address/pageSize*pageSize))
+    {
+        cout << "Error: Page cache found " << unchanged.size() << " of " << pages
+             << " pages unchanged after changing one" << endl;
+        return false;
+    }
+
+    PageCache otherSize(deviceId, 2*pageSize, dir.path());
+    if (otherSize.load())
+    {
+        cout << "Error: Page cache was used with another page size" << endl;
+        return false;
+    }
+    // A file for another device, even under this device's name
+    PageCache otherDevice("c45b self test 9876543210", pageSize, dir.path());
+    if (otherDevice.load() ||
+        !QFile::copy(written.fileName(), otherDevice.fileName()) || otherDevice.load())
+    {
+        cout << "Error: Page cache was used for another device" << endl;
+        return false;
+    }
+    return true;
+}
+
+// Simple generator, so that failures can be reproduced
+static quint32 nextRandom(quint32& state)
+{
+    state = state*1103515245 + 12345;
+    return state >> 16;
+}
+
+bool HexFileTester::testCodecs()
+{
+    static const char digits[] = "0123456789abcdefABCDEF";
+    static const char bad[] = { '/', ':', '@', 'G', '`', 'g', ' ', '\n', '\0', static_cast<char>(0x80), static_cast<char>(0xB0) };
+    const HexCodec::Kind kinds[] = { HexCodec::Sse2, HexCodec::Avx2 };
+    quint32 state = 1;
+    char text[2*255];
+    char expectedText[2*255];
+    quint8 bytes[255];
+    quint8 expectedBytes[255];
+    for (unsigned int k = 0; k < sizeof(kinds)/sizeof(kinds[0]); ++k)
+    {
+        if (!HexCodec::available(kinds[k]))
+            continue;
+        const char* name = HexCodec::name(kinds[k]);
+        // Every length, to cover the tails after the vector loops
+        for (int count = 0; count <= 255; ++count)
+            for (int round = 0; round < 8; ++round)
+            {
+                for (int i = 0; i < 2*count; ++i)
+                    text[i] = digits[nextRandom(state) % (sizeof(digits) - 1)];
+                // Half of the rounds get a bad character somewhere
+                if ((round & 1) && count)
+                    text[nextRandom(state) % (2*count)] = bad[nextRandom(state) % sizeof(bad)];
+                const quint8 seed = static_cast<quint8>(nextRandom(state));
+                quint8 expectedSum = seed;
+                quint8 sum = seed;
+                const int expected = HexCodec::decode(HexCodec::Scalar, text, count, expectedBytes, expectedSum);
+                const int result = HexCodec::decode(kinds[k], text, count, bytes, sum);
+                // The output is only defined if all characters are valid
+                if ((result != expected) || (sum != expectedSum) ||
+                    ((expected < 0) && memcmp(bytes, expectedBytes, count)))
+                {
+                    cout << "Error: " << name << " decoding of " << count << " bytes differs from scalar (returned "
+                         << result << ", expected " << expected << ")" << endl;
+                    return false;
+                }
+
+                for (int i = 0; i < count; ++i)
+                    bytes[i] = static_cast<quint8>(nextRandom(state));
+                expectedSum = sum = seed;
+                HexCodec::encode(HexCodec::Scalar, bytes, count, expectedText, expectedSum);
+                HexCodec::encode(kinds[k], bytes, count, text, sum);
+                if ((sum != expectedSum) || memcmp(text, expectedText, 2*count))
+                {
+                    cout << "Error: " << name << " encoding of " << count << " bytes differs from scalar" << endl;
+                    return false;
+                }
+            }
+    }
+    return true;
+}
+
+/// A simulated bootloader whose first page write reply is lost on the way.
+class LossyBootloader : public LoopbackPeer
+{
+public:
+    LossyBootloader(const DeviceProfile& profile)
+        : m_sim(profile),
+          m_lost(false)
+    {
+    }
+
+    virtual int receive(char c, QByteArray& o_reply)
+    {
+        const int start = o_reply.size();
+        const int busyUs = m_sim.receive(c, o_reply);
+        const int star = o_reply.indexOf('*', start);
+        if (!m_lost && (star >= 0))
+        {
+            o_reply.remove(star, 1);
+            m_lost = true;
+        }
+        return busyUs;
+    }
+
+    virtual void reset() { m_sim.reset(); }
+
+    const SimBootloader& sim() const { return m_sim; }
+
+private:
+    SimBootloader m_sim;
+    bool m_lost;
+};
+
+bool HexFileTester::testRetry(const HexFile& hf)
+{
+    const DeviceProfiles profiles;
+    const DeviceProfile* profile = profiles.find(DefaultSimulatedPart);
+    if (!profile || (hf.size() > profile->bootStart))
+    {
+        cout << "Image does not fit the simulated " << DefaultSimulatedPart << ", not testing retries" << endl;
+        return true;
+    }
+    HexChunker chunker(HexFile::DefaultRecordBytes, profile->pageSize);
+    const FlashPlan plan(hf, chunker.chunk(hf));
+    const int windows[] = { 1, 8 };
+    for (unsigned int w = 0; w < sizeof(windows)/sizeof(windows[0]); ++w)
+    {
+        LossyBootloader* device = new LossyBootloader(*profile);
+        C45BPort port(new LoopbackTransport(device), false);
+        bool ok = port.init(0);
+        if (ok)
+        {
+            port.write("UUUU\n");
+            port.readUntil(C45BPort::XON, 64);
+            port.write("pf\n");
+            port.readUntil('\r', 10);
+            port.readAvailable();
+            quint32 failedLine = 0;
+            if (windows[w] == 1)
+                for (int i = 0; ok && (i < plan.recordCount()); ++i)
+                    ok = port.downloadRecord(plan, i);
+            else
+                ok = port.downloadLines(plan, windows[w], failedLine);
+        }
+        if (!ok)
+        {
+            cout << "Error: Download with window " << windows[w] << " failed" << endl;
+            return false;
+        }
+        const HexFile::Ranges& ranges = hf.ranges();
+        for (HexFile::Ranges::const_iterator it = ranges.constBegin(); it != ranges.constEnd(); ++it)
+            if (device->sim().flash().mid(it.key(), it.value().size()) != it.value())
+            {
+                cout << "Error: Flash differs from the image after a retry with window " << windows[w] << endl;
+                return false;
+            }
+    }
+    return true;
+}
+
+// Per-nibble conversion used before the codec kernels, kept as a baseline
+static quint8 legacyAsciiToHex(unsigned char a)
+{
+    if (a >= 'a')
+        return a - 'a' + 10;
+    if (a >= 'A')
+        return a - 'A' + 10;
+    if (a >= '0')
+        return a - '0';
+    return 0;
+}
+
+static void report(const char* what, qint64 bytes, qint64 ns)
+{
+    cout << "  " << left << setw(18) << what << right << fixed << setprecision(1)
+         << setw(10) << (ns ? bytes*1000.0/ns : 0.0) << " MB/s" << endl;
+}
+
+void HexFileTester::benchmark(const QString& filename)
+{
+    QFile f(filename);
+    if (!f.open(QIODevice::ReadOnly))
+    {
+        cout << "Error opening hexfile '" << filename.toLatin1().constData() << "'" << endl;
+        return;
+    }
+    const QByteArray text = f.readAll();
+
+    // Hex digits of each record, excluding the leading ':'
+    QList<QByteArray> records;
+    foreach (const QByteArray& line, text.split('\n'))
+    {
+        const QByteArray record = line.trimmed();
+        if ((record.size() >= 11) && (record[0] == ':') && (record.size() & 1))
+            records.append(record.mid(1));
+    }
+    qint64 recordBytes = 0;
+    foreach (const QByteArray& record, records)
+        recordBytes += record.size()/2;
+    if (!recordBytes)
+    {
+        cout << "No records in '" << filename.toLatin1().constData() << "'" << endl;
+        return;
+    }
+    // Repeat until roughly 64 MB have been processed
+    const int iterations = qMax<qint64>(1, (64 << 20)/recordBytes);
+    const qint64 totalBytes = recordBytes*iterations;
+    cout << records.size() << " records, " << recordBytes << " bytes, " << iterations << " iterations" << endl;
+
+    quint8 binary[256];
+    char digits[512];
+    QElapsedTimer timer;
+    // Accumulated so the compiler cannot discard the work
+    quint8 sink = 0;
+
+    cout << "Decode:" << endl;
+    timer.start();
+    for (int i = 0; i < iterations; ++i)
+        foreach (const QByteArray& record, records)
+        {
+            const char* p = record.constData();
+            for (int j = 0; j < record.size()/2; ++j)
+            {
+                binary[j] = (legacyAsciiToHex(p[2*j]) << 4) + legacyAsciiToHex(p[2*j+1]);
+                sink += binary[j];
+            }
+        }
+    report("legacy", totalBytes, timer.nsecsElapsed());
+
+    const HexCodec::Kind kinds[] = { HexCodec::Scalar, HexCodec::Sse2, HexCodec::Avx2 };
+    for (unsigned int k = 0; k < sizeof(kinds)/sizeof(kinds[0]); ++k)
+    {
+        if (!HexCodec::available(kinds[k]))
+            continue;
+        timer.start();
+        for (int i = 0; i < iterations; ++i)
+            foreach (const QByteArray& record, records)
+                HexCodec::decode(kinds[k], record.constData(), record.size()/2, binary, sink);
+        report(HexCodec::name(kinds[k]), totalBytes, timer.nsecsElapsed());
+    }
+
+    cout << "Encode:" << endl;
+    const QChar zeropad('0');
+    timer.start();
+    for (int i = 0; i < iterations; ++i)
+        foreach (const QByteArray& record, records)
+        {
+            QString str;
+            for (int j = 0; j < record.size()/2; ++j)
+                str += QString("%1").arg(static_cast<quint8>(record[j]), 2, 16, zeropad);
+            sink += str.size();
+        }
+    report("legacy", totalBytes, timer.nsecsElapsed());
+
+    for (unsigned int k = 0; k < sizeof(kinds)/sizeof(kinds[0]); ++k)
+    {
+        if (!HexCodec::available(kinds[k]))
+            continue;
+        timer.start();
+        for (int i = 0; i < iterations; ++i)
+            foreach (const QByteArray& record, records)
+                HexCodec::encode(kinds[k], reinterpret_cast<const quint8*>(record.constData()), record.size()/2,
+                                 digits, sink);
+        report(HexCodec::name(kinds[k]), totalBytes, timer.nsecsElapsed());
+    }
+
+    cout << "Using " << HexCodec::name(HexCodec::current()) << " (checksum " << int(sink) << ")" << endl;
+}
@@ -17,9 +17,29 @@
 
 #include <QString>
 
+class HexFile;
+
 class HexFileTester
 {
 public:
     HexFileTester(){}
     void test(const QString& filename);
+
+    /// Time decoding and encoding of the records in the specified file
+    /// with each available hex codec implementation.
+    void benchmark(const QString& filename);
+
+private:
+    /// Check that every available hex codec implementation decodes and encodes random
+    /// and malformed input exactly like the scalar one.
+    bool testCodecs();
+
+    /// Save the page hashes of hf to a page cache in a temporary directory, and check
+    /// that after changing one page, the others are found unchanged, and that a cache
+    /// for another page size or device is not used.
+    bool testPageCache(const HexFile& hf);
+
+    /// Flash hf to a simulated bootloader that loses its first page write reply,
+    /// with and without pipelining, and check that the retry leaves flash intact.
+    bool testRetry(const HexFile& hf);
 };
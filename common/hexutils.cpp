@@ -17,15 +17,19 @@
 
 #include <iostream>
 #include <iomanip>
+#include <string.h>
 
 #include <QFile>
 #include <QString>
 
+#include "hexcodec.h"
 #include "hexfile.h"
+#include "hexutils.h"
+#include "hexwriter.h"
 
 using namespace std;
 
-bool writeHexfile(const QString& filename, const HexFile& hf)
+bool writeHexfile(const QString& filename, const HexFile& hf, int recordBytes)
 {
     QFile out(filename);
     if (!out.open(QIODevice::WriteOnly))
@@ -33,27 +37,27 @@ bool writeHexfile(const QString& filename, const HexFile& hf)
         cout << "Could not write file '" << filename.data() << "'" << endl;
         return false;
     }
-    out.write(hf.getHexFile().join("").toLocal8Bit());
-    out.close();
+    HexWriter writer(&out, recordBytes);
+    if (!writer.write(hf) || !writer.finish())
+    {
+        cout << "Could not write file '" << filename.toLocal8Bit().constData() << "': "
+             << writer.errorString().toLocal8Bit().constData() << endl;
+        return false;
+    }
     return true;
 }
 
-
-unsigned char asciiToHex(unsigned char a)
+int encodeSegmentRecord(char* dst, quint32 address)
 {
-    if(a >= 'a')
-        return a - 'a' + 10;
-
-    if(a >= 'A')
-        return a - 'A' + 10;
-    
-    if (a >= '0')
-        return a - '0';
-
-    return 0;
+    // The segment is given in paragraphs of 16 bytes
+    const quint16 segAddress = (address >> 16) << 12;
+    const quint8 segData[2] = { static_cast<quint8>(segAddress >> 8), static_cast<quint8>(segAddress & 0xFF) };
+    return HexCodec::encodeRecord(dst, 2, 0, segData, 2);
 }
 
-unsigned char asciiToHex(unsigned char high, unsigned char low)
+int encodeEndOfFileRecord(char* dst)
 {
-    return (asciiToHex(high) << 4) + asciiToHex(low);
+    static const char eof[] = ":00000001FF\n";
+    memcpy(dst, eof, EndOfFileRecordChars);
+    return EndOfFileRecordChars;
 }
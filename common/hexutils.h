@@ -15,12 +15,23 @@
 // You should have received a copy of the GNU General Public License
 // along with c45b.  If not, see <http://www.gnu.org/licenses/>.
 
-class HexFile;
-class QString;
+#ifndef c45b_hexutils_h
+#define c45b_hexutils_h
 
-bool writeHexfile(const QString& filename, const HexFile& hf);
+#include "hexfile.h"
 
-char asciiToHex(unsigned char a);
+/// Write hf to the specified file, using records with (at most) recordBytes data bytes each.
+bool writeHexfile(const QString& filename, const HexFile& hf, int recordBytes = HexFile::DefaultRecordBytes);
 
-char asciiToHex(unsigned char high, unsigned char low);
+/// Longest records written by encodeSegmentRecord() and encodeEndOfFileRecord()
+const int SegmentRecordChars = 16;
+const int EndOfFileRecordChars = 12;
 
+/// Write the extended segment record that selects the 64 KB segment holding address
+/// to dst. Return the number of characters written.
+int encodeSegmentRecord(char* dst, quint32 address);
+
+/// Write the end of file record to dst. Return the number of characters written.
+int encodeEndOfFileRecord(char* dst);
+
+#endif
@@ -0,0 +1,136 @@
+// Copyright 2012 Torsten Martinsen <bullestock@bullestock.net>
+
+// This file is part of c45b.
+
+// c45b is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// c45b is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with c45b.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <QFileDevice>
+
+#include "hexcodec.h"
+#include "hexfile.h"
+#include "hexutils.h"
+#include "hexwriter.h"
+
+const int HexWriter::BufferSize;
+
+HexWriter::HexWriter(QIODevice* device, int recordBytes)
+    : m_device(device),
+      m_file(0),
+      m_recordBytes(recordBytes),
+      m_segment(0),
+      m_used(0),
+      m_failed(false)
+{
+}
+
+HexWriter::HexWriter(QFileDevice* file, int recordBytes)
+    : m_device(file),
+      m_file(file),
+      m_recordBytes(recordBytes),
+      m_segment(0),
+      m_used(0),
+      m_failed(false)
+{
+}
+
+HexWriter::~HexWriter()
+{
+    flush();
+}
+
+bool HexWriter::write(const HexFile& hexFile)
+{
+    const HexFile::Ranges& ranges = hexFile.ranges();
+    for (HexFile::Ranges::const_iterator it = ranges.constBegin(); it != ranges.constEnd(); ++it)
+        if (!write(it.key(), it.value().constData(), it.value().size()))
+            return false;
+    return true;
+}
+
+bool HexWriter::write(quint32 address, const char* data, int length)
+{
+    const quint8* p = reinterpret_cast<const quint8*>(data);
+    while (length > 0)
+    {
+        // Stop at the record width and at the next 64 KB boundary
+        const quint32 segmentLeft = 0x10000 - (address & 0xFFFF);
+        const int count = qMin<quint32>(qMin(length, m_recordBytes), segmentLeft);
+        if (!writeRecord(address, p, count))
+            return false;
+        address += count;
+        p += count;
+        length -= count;
+    }
+    return true;
+}
+
+bool HexWriter::writeRecord(quint32 address, const quint8* data, int count)
+{
+    // Room for a segment record as well
+    if (!reserve(2*HexCodec::MaxRecordChars))
+        return false;
+    if ((address >> 16) != m_segment)
+    {
+        m_segment = address >> 16;
+        m_used += encodeSegmentRecord(m_buffer + m_used, address);
+    }
+    m_used += HexCodec::encodeRecord(m_buffer + m_used, 0, address & 0xFFFF, data, count);
+    return true;
+}
+
+bool HexWriter::finish()
+{
+    if (!reserve(EndOfFileRecordChars))
+        return false;
+    m_used += encodeEndOfFileRecord(m_buffer + m_used);
+    return flush();
+}
+
+bool HexWriter::reserve(int chars)
+{
+    if (m_failed)
+        return false;
+    if (BufferSize - m_used < chars)
+        return flush();
+    return true;
+}
+
+bool HexWriter::flush()
+{
+    if (m_failed)
+        return false;
+    int written = 0;
+    while (written < m_used)
+    {
+        const qint64 n = m_device->write(m_buffer + written, m_used - written);
+        if (n <= 0)
+        {
+            m_failed = true;
+            return false;
+        }
+        written += n;
+    }
+    m_used = 0;
+    if (m_file && !m_file->flush())
+    {
+        m_failed = true;
+        return false;
+    }
+    return true;
+}
+
+QString HexWriter::errorString() const
+{
+    return m_device->errorString();
+}
@@ -0,0 +1,79 @@
+// Copyright 2012 Torsten Martinsen <bullestock@bullestock.net>
+
+// This file is part of c45b.
+
+// c45b is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// c45b is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with c45b.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef c45b_hexwriter_h
+#define c45b_hexwriter_h
+
+#include <QString>
+
+class HexFile;
+class QFileDevice;
+class QIODevice;
+
+/// Writes Intel HEX records to a device.
+/// Records are encoded into a fixed buffer which is flushed to the device when full,
+/// so no memory is allocated per record.
+class HexWriter
+{
+public:
+    /// recordBytes: Largest number of data bytes per record
+    HexWriter(QIODevice* device, int recordBytes);
+
+    /// As above, but flush() also flushes the file's own buffer, so that
+    /// everything flushed survives a crash of the program.
+    HexWriter(QFileDevice* file, int recordBytes);
+
+    /// Flushes any buffered records.
+    ~HexWriter();
+
+    /// Write all populated ranges of hexFile.
+    bool write(const HexFile& hexFile);
+
+    /// Write length bytes starting at address, split into records.
+    bool write(quint32 address, const char* data, int length);
+
+    /// Write the end of file record and flush.
+    bool finish();
+
+    /// Write buffered records to the device, and on to the file system if
+    /// the device is a file.
+    bool flush();
+
+    int recordBytes() const { return m_recordBytes; }
+
+    QString errorString() const;
+
+private:
+    /// Write one data record. The record must not cross a 64 KB boundary.
+    bool writeRecord(quint32 address, const quint8* data, int count);
+
+    bool reserve(int chars);
+
+    static const int BufferSize = 4096;
+
+    QIODevice* m_device;
+    /// m_device if it is a file, otherwise 0
+    QFileDevice* m_file;
+    int m_recordBytes;
+    /// Current extended segment, i.e. address bits 16 and up
+    quint32 m_segment;
+    char m_buffer[BufferSize];
+    int m_used;
+    bool m_failed;
+};
+
+#endif
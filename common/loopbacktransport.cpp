@@ -0,0 +1,183 @@
+// Copyright 2012 Torsten Martinsen <bullestock@bullestock.net>
+
+// This file is part of c45b.
+
+// c45b is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// c45b is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with c45b.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <string.h>
+
+#include <QThread>
+
+#include "loopbacktransport.h"
+
+// Start bit, 8 data bits and 2 stop bits
+static const int BitsPerByte = 11;
+
+LoopbackTransport::LoopbackTransport(LoopbackPeer* peer)
+    : m_peer(peer),
+      m_open(false),
+      m_byteNs(0),
+      m_txFreeNs(0),
+      m_peerFreeNs(0),
+      m_rxFreeNs(0),
+      m_readOffset(0),
+      m_dtr(false),
+      m_rts(false)
+{
+    m_clock.start();
+}
+
+LoopbackTransport::~LoopbackTransport()
+{
+    delete m_peer;
+}
+
+bool LoopbackTransport::open(int baudRate)
+{
+    m_open = true;
+    m_pending.clear();
+    m_readOffset = 0;
+    m_clock.start();
+    m_txFreeNs = m_peerFreeNs = m_rxFreeNs = 0;
+    return setBaudRate(baudRate);
+}
+
+void LoopbackTransport::close()
+{
+    m_open = false;
+}
+
+bool LoopbackTransport::setBaudRate(int baudRate)
+{
+    m_byteNs = (baudRate > 0) ? Q_INT64_C(1000000000)*BitsPerByte/baudRate : 0;
+    return true;
+}
+
+void LoopbackTransport::setLine(bool& line, bool on)
+{
+    if (line == on)
+        return;
+    line = on;
+    m_peer->reset();
+    // Anything on its way is lost
+    m_pending.clear();
+    m_readOffset = 0;
+}
+
+void LoopbackTransport::setDataTerminalReady(bool on)
+{
+    setLine(m_dtr, on);
+}
+
+void LoopbackTransport::setRequestToSend(bool on)
+{
+    setLine(m_rts, on);
+}
+
+qint64 LoopbackTransport::now() const
+{
+    return m_clock.nsecsElapsed();
+}
+
+bool LoopbackTransport::sleepUntil(qint64 until, int timeout) const
+{
+    const qint64 deadline = now() + Q_INT64_C(1000000)*qMax(timeout, 0);
+    const qint64 wakeUp = qMin(until, deadline);
+    const qint64 delay = wakeUp - now();
+    if (delay > 0)
+        QThread::usleep(static_cast<unsigned long>(delay/1000));
+    return until <= deadline;
+}
+
+qint64 LoopbackTransport::write(const char* data, qint64 length)
+{
+    if (!m_open)
+    {
+        m_lastError = "Not open";
+        return -1;
+    }
+    const qint64 start = now();
+    QByteArray reply;
+    for (qint64 i = 0; i < length; ++i)
+    {
+        // When the byte has arrived, and when the peer gets to it
+        m_txFreeNs = qMax(start, m_txFreeNs) + m_byteNs;
+        const qint64 handled = qMax(m_txFreeNs, m_peerFreeNs);
+        reply.clear();
+        const int busyUs = m_peer->receive(data[i], reply);
+        m_peerFreeNs = m_byteNs ? handled + Q_INT64_C(1000)*busyUs : handled;
+        if (reply.isEmpty())
+            continue;
+        m_rxFreeNs = qMax(m_peerFreeNs, m_rxFreeNs) + reply.size()*m_byteNs;
+        if (!m_pending.isEmpty() && (m_pending.last().readyNs >= m_rxFreeNs))
+            m_pending.last().data.append(reply);
+        else
+        {
+            Chunk c;
+            c.readyNs = m_rxFreeNs;
+            c.data = reply;
+            m_pending.append(c);
+        }
+    }
+    return length;
+}
+
+void LoopbackTransport::flush()
+{
+}
+
+bool LoopbackTransport::waitForBytesWritten(int timeout)
+{
+    return sleepUntil(m_txFreeNs, timeout);
+}
+
+qint64 LoopbackTransport::bytesAvailable()
+{
+    const qint64 t = now();
+    qint64 n = -m_readOffset;
+    for (int i = 0; (i < m_pending.size()) && (m_pending.at(i).readyNs <= t); ++i)
+        n += m_pending.at(i).data.size();
+    return qMax<qint64>(n, 0);
+}
+
+bool LoopbackTransport::waitForReadyRead(int timeout)
+{
+    if (m_pending.isEmpty())
+    {
+        // Nothing will arrive
+        sleepUntil(now() + Q_INT64_C(1000000)*timeout, timeout);
+        return false;
+    }
+    return sleepUntil(m_pending.first().readyNs, timeout);
+}
+
+qint64 LoopbackTransport::read(char* data, qint64 maxLength)
+{
+    const qint64 t = now();
+    qint64 n = 0;
+    while ((n < maxLength) && !m_pending.isEmpty() && (m_pending.first().readyNs <= t))
+    {
+        const QByteArray& chunk = m_pending.first().data;
+        const int len = static_cast<int>(qMin<qint64>(maxLength - n, chunk.size() - m_readOffset));
+        memcpy(data + n, chunk.constData() + m_readOffset, len);
+        n += len;
+        m_readOffset += len;
+        if (m_readOffset == chunk.size())
+        {
+            m_pending.removeFirst();
+            m_readOffset = 0;
+        }
+    }
+    return n;
+}
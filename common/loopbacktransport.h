@@ -0,0 +1,106 @@
+// Copyright 2012 Torsten Martinsen <bullestock@bullestock.net>
+
+// This file is part of c45b.
+
+// c45b is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// c45b is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with c45b.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef c45b_loopbacktransport_h
+#define c45b_loopbacktransport_h
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QList>
+
+#include "transport.h"
+
+/// The far end of a LoopbackTransport.
+class LoopbackPeer
+{
+public:
+    virtual ~LoopbackPeer() {}
+
+    /// Handle one byte from the host. Append any reply to o_reply, and return how many
+    /// us the peer is busy before the reply is sent (e.g. while writing a flash page).
+    virtual int receive(char c, QByteArray& o_reply) = 0;
+
+    /// The device is reset through a modem control line.
+    virtual void reset() = 0;
+};
+
+/// An in-memory link to a LoopbackPeer.
+/// If a baud rate is given, the link is as slow as a serial line at that rate (with
+/// 8 data bits and 2 stop bits), and the time the peer is busy is also simulated.
+/// Otherwise data arrives as soon as it has been sent.
+class LoopbackTransport : public Transport
+{
+public:
+    /// The transport takes ownership of peer.
+    LoopbackTransport(LoopbackPeer* peer);
+
+    ~LoopbackTransport();
+
+    virtual bool open(int baudRate);
+    virtual void close();
+    virtual bool setBaudRate(int baudRate);
+    virtual void setDataTerminalReady(bool on);
+    virtual void setRequestToSend(bool on);
+    virtual qint64 write(const char* data, qint64 length);
+    virtual void flush();
+    virtual bool waitForBytesWritten(int timeout);
+    virtual qint64 bytesAvailable();
+    virtual bool waitForReadyRead(int timeout);
+    virtual qint64 read(char* data, qint64 maxLength);
+    virtual QString errorString() const { return m_lastError; }
+
+    LoopbackPeer* peer() const { return m_peer; }
+
+    /// Return true if data is on its way to the host.
+    bool hasPending() const { return !m_pending.isEmpty(); }
+
+private:
+    /// Data on its way to the host
+    struct Chunk
+    {
+        /// When the last byte has arrived (in ns since the link was opened)
+        qint64 readyNs;
+        QByteArray data;
+    };
+
+    /// Current time in ns since the link was opened
+    qint64 now() const;
+
+    /// Sleep until 'until' (ns), but at most timeout ms. Return false if it was not reached.
+    bool sleepUntil(qint64 until, int timeout) const;
+
+    /// Reset the peer if a modem line changes.
+    void setLine(bool& line, bool on);
+
+    LoopbackPeer* m_peer;
+    bool m_open;
+    /// Time to send one byte (0: No delay)
+    qint64 m_byteNs;
+    /// When the line to the peer, the peer, and the line from the peer are next free
+    qint64 m_txFreeNs;
+    qint64 m_peerFreeNs;
+    qint64 m_rxFreeNs;
+    QList<Chunk> m_pending;
+    /// Bytes of the first pending chunk already read
+    int m_readOffset;
+    bool m_dtr;
+    bool m_rts;
+    QElapsedTimer m_clock;
+    QString m_lastError;
+};
+
+#endif
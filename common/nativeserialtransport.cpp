@@ -0,0 +1,170 @@
+// Copyright 2012 Torsten Martinsen <bullestock@bullestock.net>
+
+// This file is part of c45b.
+
+// c45b is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// c45b is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with c45b.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef _WIN32
+#  include <sys/ioctl.h>
+#  include <termios.h>
+#endif
+
+#include "nativeserialtransport.h"
+
+static QString devicePath(const QString& device)
+{
+    return device.startsWith("/") ? device : QString("/dev/") + device;
+}
+
+NativeSerialTransport::NativeSerialTransport(const QString& device)
+    : TerminalTransport(devicePath(device))
+{
+}
+
+#ifdef _WIN32
+
+bool NativeSerialTransport::open(int)
+{
+    m_lastError = "The native serial backend is not supported on this platform";
+    return false;
+}
+
+bool NativeSerialTransport::setBaudRate(int)
+{
+    return false;
+}
+
+void NativeSerialTransport::setDataTerminalReady(bool)
+{
+}
+
+void NativeSerialTransport::setRequestToSend(bool)
+{
+}
+
+bool NativeSerialTransport::configure(struct termios&, int)
+{
+    return false;
+}
+
+bool NativeSerialTransport::setSpeed(struct termios&, int)
+{
+    return false;
+}
+
+void NativeSerialTransport::setModemLine(int, bool)
+{
+}
+
+#else
+
+struct BaudRate
+{
+    int rate;
+    speed_t speed;
+};
+
+static const BaudRate baudRates[] =
+{
+    { 1200,   B1200 },
+    { 2400,   B2400 },
+    { 4800,   B4800 },
+    { 9600,   B9600 },
+    { 19200,  B19200 },
+    { 38400,  B38400 },
+    { 57600,  B57600 },
+    { 115200, B115200 },
+    { 230400, B230400 }
+};
+
+bool NativeSerialTransport::open(int baudRate)
+{
+    if (!TerminalTransport::open(baudRate))
+        return false;
+    // Keep other programs off the port, as QSerialPort does
+    if (ioctl(m_fd, TIOCEXCL) < 0)
+    {
+        setError("Cannot get exclusive access");
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool NativeSerialTransport::setSpeed(struct termios& tio, int baudRate)
+{
+    for (unsigned int i = 0; i < sizeof(baudRates)/sizeof(baudRates[0]); ++i)
+        if (baudRates[i].rate == baudRate)
+        {
+            cfsetispeed(&tio, baudRates[i].speed);
+            cfsetospeed(&tio, baudRates[i].speed);
+            return true;
+        }
+    m_lastError = QString("Unsupported baud rate %1").arg(baudRate);
+    return false;
+}
+
+bool NativeSerialTransport::configure(struct termios& tio, int baudRate)
+{
+    cfmakeraw(&tio);
+    // 8N2, ignore modem status lines
+    tio.c_cflag &= ~(CSIZE | PARENB | CRTSCTS);
+    tio.c_cflag |= CS8 | CSTOPB | CLOCAL | CREAD;
+    // XON/XOFF in both directions, like QSerialPort::SoftwareControl
+    tio.c_iflag |= IXON | IXOFF | IXANY;
+    // Reads return what is there
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+    // 0: Keep the current speed
+    return (baudRate <= 0) || setSpeed(tio, baudRate);
+}
+
+// How long (in ms) setBaudRate() waits for queued data to reach the driver
+static const int ChangeTimeout = 1000;
+
+bool NativeSerialTransport::setBaudRate(int baudRate)
+{
+    struct termios tio;
+    if ((m_fd < 0) || (tcgetattr(m_fd, &tio) < 0))
+        return false;
+    // Send what is queued at the old rate
+    if (!waitForBytesWritten(ChangeTimeout))
+        return false;
+    if (!setSpeed(tio, baudRate))
+        return false;
+    if (tcsetattr(m_fd, TCSADRAIN, &tio) < 0)
+    {
+        setError("Cannot set baud rate");
+        return false;
+    }
+    return true;
+}
+
+void NativeSerialTransport::setModemLine(int line, bool on)
+{
+    if (m_fd >= 0)
+        ioctl(m_fd, on ? TIOCMBIS : TIOCMBIC, &line);
+}
+
+void NativeSerialTransport::setDataTerminalReady(bool on)
+{
+    setModemLine(TIOCM_DTR, on);
+}
+
+void NativeSerialTransport::setRequestToSend(bool on)
+{
+    setModemLine(TIOCM_RTS, on);
+}
+
+#endif
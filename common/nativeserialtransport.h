@@ -0,0 +1,49 @@
+// Copyright 2012 Torsten Martinsen <bullestock@bullestock.net>
+
+// This file is part of c45b.
+
+// c45b is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// c45b is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with c45b.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef c45b_nativeserialtransport_h
+#define c45b_nativeserialtransport_h
+
+#include "terminaltransport.h"
+
+/// A serial port driven directly through termios, without QSerialPort.
+/// The line is set up as SerialTransport does it: 8 data bits, no parity, 2 stop bits
+/// and XON/XOFF flow control. Only the standard termios baud rates are supported.
+/// Only available on POSIX systems.
+class NativeSerialTransport : public TerminalTransport
+{
+public:
+    /// device: Path of the port, or its name in /dev
+    NativeSerialTransport(const QString& device);
+
+    virtual bool open(int baudRate);
+    virtual bool setBaudRate(int baudRate);
+    virtual void setDataTerminalReady(bool on);
+    virtual void setRequestToSend(bool on);
+
+protected:
+    virtual bool configure(struct termios& tio, int baudRate);
+
+private:
+    /// Set the termios speed for baudRate. Return false if it is not supported.
+    bool setSpeed(struct termios& tio, int baudRate);
+
+    /// Raise or lower a modem control line (TIOCM_DTR or TIOCM_RTS).
+    void setModemLine(int line, bool on);
+};
+
+#endif
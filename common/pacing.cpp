@@ -0,0 +1,155 @@
+// Copyright 2012 Torsten Martinsen <bullestock@bullestock.net>
+
+// This file is part of c45b.
+
+// c45b is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// c45b is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with c45b.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "pacing.h"
+
+// Never time out faster than this (ms)
+static const int MinAckTimeout = 50;
+
+// Smallest and largest adaptive delay (us)
+static const qint64 MinDelayUs = 500;
+static const qint64 MaxDelayUs = 100000;
+
+PacingController::PacingController(int maxTimeout)
+    : m_maxTimeout(maxTimeout),
+      m_fixedDelay(0),
+      m_delayUs(0),
+      m_minRoundTrip(-1),
+      m_heldOff(false),
+      m_heldAcks(0)
+{
+}
+
+void PacingController::reset()
+{
+    m_fixedDelay = 0;
+    m_delayUs = 0;
+    m_record = Estimate();
+    m_page = Estimate();
+    m_minRoundTrip = -1;
+    m_interval = Estimate();
+    m_heldOff = false;
+    m_heldAcks = 0;
+}
+
+void PacingController::setFixedDelay(int ms)
+{
+    m_fixedDelay = ms;
+}
+
+void PacingController::seedPageLatency(qint64 us)
+{
+    if (m_page.average < 0)
+        m_page.add(us);
+}
+
+int PacingController::recordDelay() const
+{
+    if (m_fixedDelay > 0)
+        return m_fixedDelay;
+    return static_cast<int>((m_delayUs + 999)/1000);
+}
+
+int PacingController::ackTimeout() const
+{
+    if ((m_record.average < 0) || (m_page.average < 0))
+        // Don't know what a page write costs yet
+        return m_maxTimeout;
+    const qint64 us = qMax(m_record.timeout(), m_page.timeout());
+    return static_cast<int>(qBound<qint64>(MinAckTimeout, us/1000 + 1, m_maxTimeout));
+}
+
+void PacingController::acknowledged(qint64 latencyUs, bool pageWrite)
+{
+    Estimate& e = pageWrite ? m_page : m_record;
+    // Replies arriving no later than usual allow us to tighten the delay
+    const bool fast = (e.average >= 0) && (latencyUs <= e.average);
+    // ...while one well outside the usual spread means it is falling behind
+    const bool slow = (e.average >= 0) && (latencyUs > e.timeout());
+    e.add(latencyUs);
+    // So does an XOFF that outlasts the reply it came with
+    const bool held = m_heldOff && (++m_heldAcks == 2);
+    if (slow || held)
+        backOff();
+    else if (fast)
+    {
+        m_delayUs -= m_delayUs/8;
+        if (m_delayUs < MinDelayUs)
+            m_delayUs = 0;
+    }
+}
+
+void PacingController::timedOut()
+{
+    backOff();
+}
+
+void PacingController::throttled()
+{
+    if (!m_heldOff)
+    {
+        m_heldOff = true;
+        m_heldAcks = 0;
+    }
+}
+
+void PacingController::released()
+{
+    m_heldOff = false;
+}
+
+void PacingController::backOff()
+{
+    m_delayUs = qBound(MinDelayUs, 2*m_delayUs, MaxDelayUs);
+}
+
+void PacingController::addRoundTrip(qint64 us)
+{
+    if ((m_minRoundTrip < 0) || (us < m_minRoundTrip))
+        m_minRoundTrip = us;
+}
+
+void PacingController::ackInterval(qint64 intervalUs)
+{
+    m_interval.add(qMax<qint64>(intervalUs, 1));
+}
+
+int PacingController::window(int maxWindow) const
+{
+    if ((m_minRoundTrip < 0) || (m_interval.average <= 0))
+        return qMin(2, maxWindow);
+    const qint64 inFlight = (m_minRoundTrip + m_interval.average - 1)/m_interval.average + 1;
+    return static_cast<int>(qBound<qint64>(1, inFlight, maxWindow));
+}
+
+void PacingController::Estimate::add(qint64 sample)
+{
+    // Same smoothing as TCP's round trip time estimator (RFC 6298)
+    if (average < 0)
+    {
+        average = sample;
+        deviation = sample/2;
+        return;
+    }
+    deviation += (qAbs(sample - average) - deviation)/4;
+    average += (sample - average)/8;
+}
+
+qint64 PacingController::Estimate::timeout() const
+{
+    return average + 4*deviation;
+}
@@ -0,0 +1,116 @@
+// Copyright 2012 Torsten Martinsen <bullestock@bullestock.net>
+
+// This file is part of c45b.
+
+// c45b is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// c45b is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with c45b.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef c45b_pacing_h
+#define c45b_pacing_h
+
+#include <QtGlobal>
+
+/// Learns how fast the bootloader acknowledges ordinary records and page writes,
+/// and derives the delay between records and the acknowledgement timeout from that.
+class PacingController
+{
+public:
+    /// maxTimeout: Upper bound (in ms) for ackTimeout()
+    explicit PacingController(int maxTimeout);
+
+    /// Forget everything learned so far.
+    void reset();
+
+    /// Use a fixed delay (in ms) between records. 0: Adapt the delay.
+    void setFixedDelay(int ms);
+
+    /// Assume page writes take about us microseconds until one has been measured.
+    void seedPageLatency(qint64 us);
+
+    /// Delay (in ms) to wait before sending the next record.
+    int recordDelay() const;
+
+    /// How many ms to wait for the next record to be acknowledged.
+    int ackTimeout() const;
+
+    /// A record was acknowledged after latencyUs microseconds. A latency well
+    /// above the usual one is taken as congestion.
+    void acknowledged(qint64 latencyUs, bool pageWrite);
+
+    /// A record was not acknowledged within ackTimeout().
+    void timedOut();
+
+    /// The bootloader sent XOFF. chip45boot2 sends XOFF and XON around every
+    /// reply, so this only counts as congestion if no XON has arrived by the
+    /// time the next record is acknowledged. Serial ports consume XON/XOFF for
+    /// flow control, so only transports that pass them through (loopback, TCP)
+    /// ever report them; elsewhere acknowledged() detects congestion by latency.
+    void throttled();
+
+    /// The bootloader sent XON.
+    void released();
+
+    /// A reply came back us microseconds after its request was sent. The shortest
+    /// round trip is kept, as it is the one least inflated by queueing.
+    void addRoundTrip(qint64 us);
+
+    /// Replies to requests that were sent back to back arrived intervalUs apart.
+    void ackInterval(qint64 intervalUs);
+
+    /// Number of requests to keep in flight so that the link does not go idle while
+    /// waiting for replies: As many as are answered in a round trip, plus one.
+    /// 2 until both are known; never more than maxWindow.
+    int window(int maxWindow) const;
+
+    /// Shortest round trip (in us), or -1 if unknown.
+    qint64 minRoundTrip() const { return m_minRoundTrip; }
+
+    /// Smoothed time (in us) between replies to back-to-back requests, or -1 if unknown.
+    qint64 replyInterval() const { return m_interval.average; }
+
+    /// Smoothed acknowledgement latency (in us) of ordinary records, or -1 if unknown.
+    qint64 recordLatency() const { return m_record.average; }
+
+    /// Smoothed acknowledgement latency (in us) of page writes, or -1 if unknown.
+    qint64 pageLatency() const { return m_page.average; }
+
+private:
+    struct Estimate
+    {
+        Estimate() : average(-1), deviation(0) {}
+
+        void add(qint64 sample);
+
+        /// Timeout (in us) that covers this kind of reply
+        qint64 timeout() const;
+
+        qint64 average;
+        qint64 deviation;
+    };
+
+    void backOff();
+
+    const int m_maxTimeout;
+    int m_fixedDelay;
+    qint64 m_delayUs;
+    Estimate m_record;
+    Estimate m_page;
+    qint64 m_minRoundTrip;
+    Estimate m_interval;
+    /// XOFF seen and not yet lifted by XON
+    bool m_heldOff;
+    /// Records acknowledged since the XOFF
+    int m_heldAcks;
+};
+
+#endif
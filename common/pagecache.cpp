@@ -0,0 +1,137 @@
+// Copyright 2012 Torsten Martinsen <bullestock@bullestock.net>
+
+// This file is part of c45b.
+
+// c45b is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// c45b is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with c45b.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <QStringList>
+#include <QTextStream>
+
+#include "c45butils.h"
+#include "hexfile.h"
+#include "pagecache.h"
+
+// First line of a cache file
+static const char* Signature = "c45b page cache 1";
+
+PageCache::PageCache(const QString& deviceId, int pageSize, const QString& directory)
+    : m_pageSize(pageSize)
+{
+    // The ID may contain anything, so files refer to it by its hash
+    m_key = QString::fromLatin1(QCryptographicHash::hash(deviceId.toUtf8(), QCryptographicHash::Sha1).toHex());
+    m_fileName = (directory.isEmpty() ? CacheDirectory() : directory) + "/" + m_key + ".pages";
+}
+
+bool PageCache::load()
+{
+    m_hashes.clear();
+    QFile f(m_fileName);
+    if (!f.open(QIODevice::ReadOnly | QIODevice::Text))
+    {
+        m_lastError = "No page cache for this device";
+        return false;
+    }
+    QTextStream in(&f);
+    if ((in.readLine() != Signature) || (in.readLine() != m_key))
+    {
+        m_lastError = "Page cache has the wrong format";
+        return false;
+    }
+    if (in.readLine() != QString("pagesize %1").arg(m_pageSize))
+    {
+        m_lastError = "Page cache was written with another page size";
+        return false;
+    }
+    Hashes hashes;
+    while (!in.atEnd())
+    {
+        const QStringList fields = in.readLine().split(' ');
+        bool ok = false;
+        const quint32 address = fields.first().toUInt(&ok, 16);
+        if ((fields.size() != 2) || !ok || (address % m_pageSize))
+        {
+            m_lastError = "Page cache is corrupt";
+            return false;
+        }
+        hashes.insert(address, QByteArray::fromHex(fields.last().toLatin1()));
+    }
+    m_hashes = hashes;
+    return true;
+}
+
+QSet<quint32> PageCache::unchangedPages(const HexFile& image) const
+{
+    QSet<quint32> pages;
+    const Hashes hashes = hashPages(image);
+    for (Hashes::const_iterator it = hashes.constBegin(); it != hashes.constEnd(); ++it)
+        if (m_hashes.value(it.key()) == it.value())
+            pages.insert(it.key());
+    return pages;
+}
+
+bool PageCache::invalidate()
+{
+    if (QFile::exists(m_fileName) && !QFile::remove(m_fileName))
+    {
+        m_lastError = QString("Cannot remove '%1'").arg(m_fileName);
+        return false;
+    }
+    return true;
+}
+
+bool PageCache::save(const HexFile& image)
+{
+    // Pages not in the image keep their previous contents
+    const Hashes hashes = hashPages(image);
+    for (Hashes::const_iterator it = hashes.constBegin(); it != hashes.constEnd(); ++it)
+        m_hashes.insert(it.key(), it.value());
+
+    QDir().mkpath(QFileInfo(m_fileName).absolutePath());
+    QSaveFile f(m_fileName);
+    if (!f.open(QIODevice::WriteOnly | QIODevice::Text))
+    {
+        m_lastError = QString("Cannot write '%1': %2").arg(m_fileName).arg(f.errorString());
+        return false;
+    }
+    QTextStream out(&f);
+    out << Signature << "\n" << m_key << "\n" << "pagesize " << m_pageSize << "\n";
+    for (Hashes::const_iterator it = m_hashes.constBegin(); it != m_hashes.constEnd(); ++it)
+        out << QString("%1 ").arg(it.key(), 8, 16, QChar('0')) << it.value().toHex() << "\n";
+    out.flush();
+    if (!f.commit())
+    {
+        m_lastError = QString("Cannot write '%1': %2").arg(m_fileName).arg(f.errorString());
+        return false;
+    }
+    return true;
+}
+
+PageCache::Hashes PageCache::hashPages(const HexFile& image) const
+{
+    Hashes hashes;
+    const HexFile::Ranges& ranges = image.ranges();
+    for (HexFile::Ranges::const_iterator it = ranges.constBegin(); it != ranges.constEnd(); ++it)
+    {
+        const quint32 end = it.key() + it.value().size();
+        for (quint32 page = it.key()/m_pageSize*m_pageSize; page < end; page += m_pageSize)
+            if (!hashes.contains(page))
+                hashes.insert(page, QCryptographicHash::hash(image.data(page, m_pageSize),
+                                                             QCryptographicHash::Sha1));
+    }
+    return hashes;
+}
@@ -0,0 +1,70 @@
+// Copyright 2012 Torsten Martinsen <bullestock@bullestock.net>
+
+// This file is part of c45b.
+
+// c45b is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// c45b is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with c45b.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef c45b_pagecache_h
+#define c45b_pagecache_h
+
+#include <QByteArray>
+#include <QMap>
+#include <QSet>
+#include <QString>
+
+class HexFile;
+
+/// On-disk record of the flash pages last written to a device, stored as one hash per page.
+/// Since flash cannot be read back, this is what makes it possible to only send the pages
+/// that have changed.
+class PageCache
+{
+public:
+    /// deviceId: Identifies the device, e.g. port name and serial number
+    /// directory: Where to keep the file (default: CacheDirectory())
+    PageCache(const QString& deviceId, int pageSize, const QString& directory = QString());
+
+    /// Load the hashes stored for the device.
+    /// Return false if there are none, or if they cannot be used.
+    bool load();
+
+    /// Return the start addresses of the pages of image that the device already holds.
+    QSet<quint32> unchangedPages(const HexFile& image) const;
+
+    /// Delete the stored hashes. Call this before flashing, so an interrupted
+    /// download cannot leave hashes that do not match the device.
+    bool invalidate();
+
+    /// Record that image has been written to the device, and store the hashes.
+    bool save(const HexFile& image);
+
+    QString fileName() const { return m_fileName; }
+
+    QString errorString() const { return m_lastError; }
+
+private:
+    typedef QMap<quint32, QByteArray> Hashes;
+
+    /// Return the hash of each page that image touches, keyed by page address.
+    Hashes hashPages(const HexFile& image) const;
+
+    /// Hash of the device ID, in hex
+    QString m_key;
+    int m_pageSize;
+    QString m_fileName;
+    Hashes m_hashes;
+    QString m_lastError;
+};
+
+#endif
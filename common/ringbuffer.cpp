@@ -0,0 +1,99 @@
+// Copyright 2012 Torsten Martinsen <bullestock@bullestock.net>
+
+// This file is part of c45b.
+
+// c45b is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// c45b is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with c45b.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <string.h>
+
+#include "ringbuffer.h"
+
+RingBuffer::RingBuffer(int capacity)
+    : m_mask(0),
+      m_head(0),
+      m_size(0)
+{
+    int size = 1;
+    while (size < capacity)
+        size <<= 1;
+    m_data.resize(size);
+    m_mask = size-1;
+}
+
+int RingBuffer::indexOf(char c, int from) const
+{
+    // Search the (at most two) contiguous parts of the buffer
+    while (from < m_size)
+    {
+        const int start = (m_head + from) & m_mask;
+        const int len = qMin(m_size - from, m_data.size() - start);
+        const char* p = m_data.constData() + start;
+        const void* found = memchr(p, c, len);
+        if (found)
+            return from + static_cast<int>(static_cast<const char*>(found) - p);
+        from += len;
+    }
+    return -1;
+}
+
+char* RingBuffer::writePointer(int& len)
+{
+    const int tail = (m_head + m_size) & m_mask;
+    len = qMin(freeSpace(), m_data.size() - tail);
+    return m_data.data() + tail;
+}
+
+void RingBuffer::commit(int len)
+{
+    m_size += qMin(len, freeSpace());
+}
+
+int RingBuffer::write(const char* data, int len)
+{
+    int written = 0;
+    while ((written < len) && freeSpace())
+    {
+        int chunk = 0;
+        char* p = writePointer(chunk);
+        chunk = qMin(chunk, len - written);
+        memcpy(p, data + written, chunk);
+        commit(chunk);
+        written += chunk;
+    }
+    return written;
+}
+
+QByteArray RingBuffer::read(int len)
+{
+    len = qMin(len, m_size);
+    QByteArray result(len, 0);
+    const int first = qMin(len, m_data.size() - m_head);
+    memcpy(result.data(), m_data.constData() + m_head, first);
+    memcpy(result.data() + first, m_data.constData(), len - first);
+    skip(len);
+    return result;
+}
+
+void RingBuffer::skip(int len)
+{
+    len = qMin(len, m_size);
+    m_head = (m_head + len) & m_mask;
+    m_size -= len;
+}
+
+void RingBuffer::clear()
+{
+    m_head = 0;
+    m_size = 0;
+}
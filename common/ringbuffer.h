@@ -0,0 +1,66 @@
+// Copyright 2012 Torsten Martinsen <bullestock@bullestock.net>
+
+// This file is part of c45b.
+
+// c45b is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// c45b is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with c45b.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef c45b_ringbuffer_h
+#define c45b_ringbuffer_h
+
+#include <QByteArray>
+
+/// Fixed-capacity byte FIFO used for buffering received data.
+class RingBuffer
+{
+public:
+    /// The capacity is rounded up to a power of two.
+    explicit RingBuffer(int capacity = 4096);
+
+    int size() const { return m_size; }
+
+    bool isEmpty() const { return m_size == 0; }
+
+    int freeSpace() const { return m_data.size() - m_size; }
+
+    /// Return the i'th byte from the front of the buffer.
+    char at(int i) const { return m_data.at((m_head + i) & m_mask); }
+
+    /// Return the index of the first occurrence of c at or after from, or -1.
+    int indexOf(char c, int from = 0) const;
+
+    /// Return the largest contiguous free region, and set len to its size.
+    /// Call commit() after writing to it.
+    char* writePointer(int& len);
+
+    void commit(int len);
+
+    /// Append up to len bytes, returning the number of bytes stored.
+    int write(const char* data, int len);
+
+    /// Remove and return up to len bytes from the front of the buffer.
+    QByteArray read(int len);
+
+    /// Remove up to len bytes from the front of the buffer.
+    void skip(int len);
+
+    void clear();
+
+private:
+    QByteArray m_data;
+    int m_mask;
+    int m_head;
+    int m_size;
+};
+
+#endif
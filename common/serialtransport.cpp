@@ -0,0 +1,88 @@
+// Copyright 2012 Torsten Martinsen <bullestock@bullestock.net>
+
+// This file is part of c45b.
+
+// c45b is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// c45b is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with c45b.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "serialtransport.h"
+
+SerialTransport::SerialTransport(const QString& device)
+    : m_port(device)
+{
+}
+
+bool SerialTransport::open(int baudRate)
+{
+    m_port.setBaudRate(baudRate);
+    m_port.setFlowControl(QSerialPort::SoftwareControl);
+    m_port.setParity(QSerialPort::NoParity);
+    m_port.setDataBits(QSerialPort::Data8);
+    m_port.setStopBits(QSerialPort::TwoStop);
+    return m_port.open(QIODevice::ReadWrite);
+}
+
+void SerialTransport::close()
+{
+    m_port.close();
+}
+
+bool SerialTransport::setBaudRate(int baudRate)
+{
+    return m_port.setBaudRate(baudRate);
+}
+
+void SerialTransport::setDataTerminalReady(bool on)
+{
+    m_port.setDataTerminalReady(on);
+}
+
+void SerialTransport::setRequestToSend(bool on)
+{
+    m_port.setRequestToSend(on);
+}
+
+qint64 SerialTransport::write(const char* data, qint64 length)
+{
+    return m_port.write(data, length);
+}
+
+void SerialTransport::flush()
+{
+    m_port.flush();
+}
+
+bool SerialTransport::waitForBytesWritten(int timeout)
+{
+    return m_port.waitForBytesWritten(timeout);
+}
+
+qint64 SerialTransport::bytesAvailable()
+{
+    return m_port.bytesAvailable();
+}
+
+bool SerialTransport::waitForReadyRead(int timeout)
+{
+    return m_port.waitForReadyRead(timeout);
+}
+
+qint64 SerialTransport::read(char* data, qint64 maxLength)
+{
+    return m_port.read(data, maxLength);
+}
+
+QString SerialTransport::errorString() const
+{
+    return m_port.errorString();
+}
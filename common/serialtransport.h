@@ -0,0 +1,50 @@
+// Copyright 2012 Torsten Martinsen <bullestock@bullestock.net>
+
+// This file is part of c45b.
+
+// c45b is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// c45b is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with c45b.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef c45b_serialtransport_h
+#define c45b_serialtransport_h
+
+#include <QtSerialPort/qserialport.h>
+
+#include "transport.h"
+
+/// A serial port, set up as chip45boot2 expects: 8 data bits, no parity,
+/// 2 stop bits and XON/XOFF flow control.
+class SerialTransport : public Transport
+{
+public:
+    SerialTransport(const QString& device);
+
+    virtual bool needsApplication() const { return true; }
+    virtual bool open(int baudRate);
+    virtual void close();
+    virtual bool setBaudRate(int baudRate);
+    virtual void setDataTerminalReady(bool on);
+    virtual void setRequestToSend(bool on);
+    virtual qint64 write(const char* data, qint64 length);
+    virtual void flush();
+    virtual bool waitForBytesWritten(int timeout);
+    virtual qint64 bytesAvailable();
+    virtual bool waitForReadyRead(int timeout);
+    virtual qint64 read(char* data, qint64 maxLength);
+    virtual QString errorString() const;
+
+private:
+    QSerialPort m_port;
+};
+
+#endif
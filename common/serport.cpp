@@ -18,71 +18,371 @@
 #include <iostream>
 #include <iomanip>
 
+#include <QElapsedTimer>
+#include <QVector>
+
 #include "c45butils.h"
+#include "hexwriter.h"
 #include "platform.h"
 #include "serport.h"
 
 using namespace std;
 
-C45BSerialPort::C45BSerialPort(QString device,
-                               bool verbose)
-    : QSerialPort(device),
-      m_verbose(verbose)
+C45BPort::C45BPort(Transport* transport,
+                   bool verbose)
+    : m_transport(transport),
+      m_verbose(verbose),
+      m_retryLimit(DefaultRetryLimit),
+      m_observer(0),
+      m_roundTripUs(-1),
+      m_pacing(AckTimeout)
 {
 }
 
-C45BSerialPort::~C45BSerialPort()
+C45BPort::~C45BPort()
 {
+    delete m_transport;
 }
 
-bool C45BSerialPort::init(int baudRate)
+bool C45BPort::init(int baudRate)
 {
-    setBaudRate(baudRate);
-    setFlowControl(QSerialPort::SoftwareControl);
-    setParity(QSerialPort::NoParity);
-    setDataBits(QSerialPort::Data8);
-    setStopBits(QSerialPort::TwoStop);
-    return open(QIODevice::ReadWrite);       
+    return m_transport->open(baudRate);
 }
 
-QByteArray C45BSerialPort::readUntil(char terminator, qint64 maxSize)
+void C45BPort::pulseReset(int lines, bool activeHigh, int pulseMs)
 {
-    QByteArray data;
-    qint64 bytesRead = 0;
-    while (bytesRead < maxSize)
+    if (lines & ResetDtr)
+        m_transport->setDataTerminalReady(activeHigh);
+    if (lines & ResetRts)
+        m_transport->setRequestToSend(activeHigh);
+    Msleep(pulseMs);
+    if (lines & ResetDtr)
+        m_transport->setDataTerminalReady(!activeHigh);
+    if (lines & ResetRts)
+        m_transport->setRequestToSend(!activeHigh);
+}
+
+// Longest time (ms) to wait for the line to go quiet when resynchronising
+static const int ResyncQuietTime = 200;
+
+// Longest time (ms) to spend draining a line that does not go quiet
+static const int ResyncMaxTime = 4*ResyncQuietTime;
+
+static int remainingTime(const QElapsedTimer& t, int timeout)
+{
+    return qMax(0, timeout - static_cast<int>(t.elapsed()));
+}
+
+bool C45BPort::fillBuffer(int timeout)
+{
+    if (!m_transport->bytesAvailable() && ((timeout <= 0) || !m_transport->waitForReadyRead(timeout)))
+        return false;
+    qint64 total = 0;
+    while (m_rxBuffer.freeSpace())
     {
-        if (!waitForReadyRead(100))
-            // Timeout
-            break;
-        unsigned char c = 0;
-        getChar(reinterpret_cast<char*>(&c));
-        if (c == terminator)
+        int len = 0;
+        char* p = m_rxBuffer.writePointer(len);
+        const qint64 n = m_transport->read(p, len);
+        if (n <= 0)
             break;
-        data.append(c);
+        m_rxBuffer.commit(static_cast<int>(n));
+        total += n;
+    }
+    return total > 0;
+}
+
+QByteArray C45BPort::readUntil(char terminator, qint64 maxSize, int timeout)
+{
+    QElapsedTimer t;
+    t.start();
+    const int limit = static_cast<int>(qMin<qint64>(maxSize, m_rxBuffer.freeSpace() + m_rxBuffer.size()));
+    int from = 0;
+    while (true)
+    {
+        const int pos = m_rxBuffer.indexOf(terminator, from);
+        if ((pos >= 0) && (pos < limit))
+        {
+            QByteArray data = m_rxBuffer.read(pos);
+            m_rxBuffer.skip(1);
+            return data;
+        }
+        if (m_rxBuffer.size() >= limit)
+            return m_rxBuffer.read(limit);
+        from = m_rxBuffer.size();
+        if (!fillBuffer(remainingTime(t, timeout)) && (t.elapsed() >= timeout))
+            // Timeout
+            return m_rxBuffer.read(limit);
     }
+}
+
+QByteArray C45BPort::readAvailable()
+{
+    QByteArray data;
+    do
+        data.append(m_rxBuffer.read(m_rxBuffer.size()));
+    while (fillBuffer(0));
     return data;
 }
 
-bool C45BSerialPort::downloadLine(QString s)
+qint64 C45BPort::bufferedBytes()
+{
+    fillBuffer(0);
+    return m_rxBuffer.size() + m_transport->bytesAvailable();
+}
+
+bool C45BPort::waitForData(int timeout)
+{
+    return !m_rxBuffer.isEmpty() || fillBuffer(timeout);
+}
+
+QByteArray C45BPort::readReply(int timeout)
+{
+    QElapsedTimer t;
+    t.start();
+    int scanned = 0;
+    while (true)
+    {
+        for (; scanned < m_rxBuffer.size(); ++scanned)
+        {
+            const char c = m_rxBuffer.at(scanned);
+            if ((c == '.') || (c == '*') || (c == '-'))
+                return m_rxBuffer.read(scanned+1);
+        }
+        if (!fillBuffer(remainingTime(t, timeout)) && (t.elapsed() >= timeout))
+            // Timeout
+            return m_rxBuffer.read(m_rxBuffer.size());
+        if (!m_rxBuffer.freeSpace())
+            // Discard noise
+            scanned -= m_rxBuffer.read(scanned).size();
+    }
+}
+
+bool C45BPort::readLine(QByteArray& line, int timeout)
+{
+    QElapsedTimer t;
+    t.start();
+    int from = 0;
+    while (true)
+    {
+        int end = m_rxBuffer.indexOf('\r', from);
+        const int lf = m_rxBuffer.indexOf('\n', from);
+        if ((lf >= 0) && ((end < 0) || (lf < end)))
+            end = lf;
+        if (end >= 0)
+        {
+            line = m_rxBuffer.read(end);
+            m_rxBuffer.skip(1);
+            line.replace(XON, "");
+            line.replace(XOFF, "");
+            line = line.trimmed();
+            return true;
+        }
+        if (!m_rxBuffer.freeSpace())
+        {
+            // Discard noise
+            m_rxBuffer.clear();
+            from = 0;
+        }
+        else
+            from = m_rxBuffer.size();
+        if (!fillBuffer(remainingTime(t, timeout)) && (t.elapsed() >= timeout))
+            return false;
+    }
+}
+
+bool C45BPort::readEeprom(quint32 address, quint32 length, int window, QByteArray& o_data)
+{
+    quint32 received = 0;
+    return readEeprom(address, length, window, o_data, 0, received);
+}
+
+bool C45BPort::readEeprom(quint32 address, quint32 length, int window, HexWriter& writer)
+{
+    QByteArray pending;
+    quint32 received = 0;
+    const bool ok = readEeprom(address, length, window, pending, &writer, received);
+    // Keep whatever was read before a failure
+    if (!writer.write(address + received - pending.size(), pending.constData(), pending.size()) || !writer.flush())
+    {
+        cout << "Error: Could not write EEPROM data: " << writer.errorString().toLocal8Bit().constData() << endl;
+        return false;
+    }
+    return ok;
+}
+
+bool C45BPort::readEeprom(quint32 address, quint32 length, int window, QByteArray& o_data,
+                                HexWriter* writer, quint32& o_received)
+{
+    if (window == AutoWindow)
+    {
+        if (m_roundTripUs >= 0)
+            m_pacing.addRoundTrip(m_roundTripUs);
+        window = m_pacing.window(MaxWindow);
+    }
+    if (window < 1)
+        window = 1;
+    o_data.clear();
+    o_data.reserve(writer ? writer->recordBytes() : length);
+    o_received = 0;
+    quint32 sent = 0;
+    // True when the echo for the oldest outstanding request has been seen
+    bool gotEcho = false;
+    QByteArray line;
+    while (o_received < length)
+    {
+        // Keep the window full
+        const quint32 received = o_received;
+        if ((sent < length) && (sent - received < static_cast<quint32>(window)))
+        {
+            while ((sent < length) && (sent - received < static_cast<quint32>(window)))
+            {
+                char cmd[16];
+                const int len = qsnprintf(cmd, sizeof(cmd), "er%04x\n", address + sent);
+                write(cmd, len);
+                ++sent;
+            }
+            flush();
+        }
+
+        const quint32 expected = address + received;
+        if (!readLine(line, ReadTimeout))
+        {
+            cout << "Error: No reply to 'er' command for address " << expected << endl;
+            return false;
+        }
+        // The prompt has no line ending, so it starts the following line
+        while (line.startsWith('>'))
+            line = line.mid(1).trimmed();
+        if (line.isEmpty())
+            continue;
+
+        if (line.startsWith("er"))
+        {
+            // Echo of the request: "erXXXX+"
+            bool ok = false;
+            const quint32 echoAddress = line.mid(2, 4).toUInt(&ok, 16);
+            if (!ok || !line.endsWith('+'))
+            {
+                cout << "Error: Bootloader did not respond to 'er' command" << endl;
+                if (m_verbose)
+                    cout << "Reply: " << FormatControlChars(line).toStdString() << endl;
+                return false;
+            }
+            if (gotEcho)
+            {
+                cout << "Error: Missing EEPROM value for address " << expected << endl;
+                return false;
+            }
+            if (echoAddress != expected)
+            {
+                cout << "Error: Out of order reply to 'er' command: Expected address "
+                     << expected << ", got " << echoAddress << endl;
+                return false;
+            }
+            gotEcho = true;
+            continue;
+        }
+
+        // Value
+        if (!gotEcho)
+        {
+            cout << "Error: EEPROM value without a request for address " << expected << endl;
+            if (m_verbose)
+                cout << "Reply: " << FormatControlChars(line).toStdString() << endl;
+            return false;
+        }
+        bool ok = false;
+        const uint value = line.toUInt(&ok, 16);
+        if (!ok || (value > 0xFF))
+        {
+            cout << "Error: Malformed EEPROM value for address " << expected << endl;
+            if (m_verbose)
+                cout << "Reply: " << FormatControlChars(line).toStdString() << endl;
+            return false;
+        }
+        o_data.append(static_cast<char>(value));
+        ++o_received;
+        gotEcho = false;
+        if (writer && (o_data.size() >= writer->recordBytes()))
+        {
+            if (!writer->write(address + o_received - o_data.size(), o_data.constData(), o_data.size()) ||
+                !writer->flush())
+                // Reported by the caller
+                return false;
+            o_data.clear();
+        }
+    }
+    return true;
+}
+
+qint64 C45BPort::measureRoundTrip(int samples)
+{
+    QElapsedTimer t;
+    for (int i = 0; i < samples; ++i)
+    {
+        readAvailable();
+        t.start();
+        // An empty line is answered with a prompt
+        putChar('\n');
+        flush();
+        readUntil('>', 64, ReadTimeout);
+        const qint64 us = t.nsecsElapsed()/1000;
+        if (us >= 1000*ReadTimeout)
+            // No prompt
+            continue;
+        if ((m_roundTripUs < 0) || (us < m_roundTripUs))
+            m_roundTripUs = us;
+    }
+    readAvailable();
+    return m_roundTripUs;
+}
+
+void C45BPort::pace()
 {
+    const int delay = m_pacing.recordDelay();
+    if (delay <= 0)
+        return;
+    QElapsedTimer t;
+    t.start();
+    Msleep(delay);
+    m_stats.delayNs += t.nsecsElapsed();
+}
+
+bool C45BPort::downloadLine(const char* record, int length, char* o_reply)
+{
+    pace();
+
+    QElapsedTimer t;
+    t.start();
+
 	// Send the hex record
-    // if (m_verbose)
-    //     cout << "Sending '" << s.trimmed().toLatin1().data() << "'" << endl;
-    write(s.toLatin1());
-	
-	// read until XON, 10 characters or timeout
-    Msleep(8);
-
-    QByteArray r = readUntil(XON, 10);
+    write(record, length);
+    m_transport->waitForBytesWritten(AckTimeout);
+    m_stats.transmitNs += t.nsecsElapsed();
+    ++m_stats.records;
+
+    // Return as soon as the reply arrives
+    t.start();
+    QByteArray r = readReply(m_pacing.ackTimeout());
+    const qint64 latency = t.nsecsElapsed();
+    m_stats.waitNs += latency;
     //cout << "REPLY " << QString(r).toLatin1().data() << endl;
+    for (int i = 0; i < r.size(); ++i)
+        if (r[i] == XOFF)
+            m_pacing.throttled();
+        else if (r[i] == XON)
+            m_pacing.released();
     // The bootloader replies with '.' on success...
     if( r.contains('-') )
     {
-        cout << "Something went wrong during programming " << endl;
+        if (m_verbose)
+            cout << "Record rejected" << endl;
         return false;
     }
     if (!r.contains('.') && !r.contains('*'))
     {
+        if (r.isEmpty())
+            m_pacing.timedOut();
         if (m_verbose)
         {
             if (r.isEmpty())
@@ -93,7 +393,248 @@ bool C45BSerialPort::downloadLine(QString s)
         return false;
     }
     // ...and with '*' on page write
+    m_pacing.acknowledged(latency/1000, r.contains('*'));
     if (m_verbose && r.contains('*'))
         std::cout << "+" << std::flush;
+    if (o_reply)
+        *o_reply = r.contains('*') ? '*' : '.';
+    return true;
+}
+
+bool C45BPort::downloadRecord(const FlashPlan& plan, int i)
+{
+    int attempt = 0;
+    while (true)
+    {
+        bool ok = true;
+        if (attempt > 0)
+        {
+            // The bootloader starts the page afresh, so resend what went before i on it
+            const int start = plan.pageStart(i);
+            ok = prepareRetry(plan, start);
+            for (int j = start; ok && (j < i); ++j)
+                ok = downloadLine(plan.text(j), plan.record(j).length);
+        }
+        char reply = 0;
+        if (ok && downloadLine(plan.text(i), plan.record(i).length, &reply))
+        {
+            if (m_observer)
+                m_observer->recordAcknowledged(plan, i, reply);
+            return true;
+        }
+        if (++attempt > m_retryLimit)
+            return false;
+        ++m_stats.retries;
+        if (m_verbose)
+            cout << "Retrying record " << (i+1) << endl;
+    }
+}
+
+void C45BPort::resync()
+{
+    // Replies still on their way would be taken for replies to the resent record
+    const int quiet = qMin(m_pacing.ackTimeout(), ResyncQuietTime);
+    const int limit = qMax(m_pacing.ackTimeout(), ResyncMaxTime);
+    QElapsedTimer t;
+    t.start();
+    do
+        m_rxBuffer.clear();
+    while ((t.elapsed() < limit) && fillBuffer(qMin(quiet, remainingTime(t, limit))));
+    m_rxBuffer.clear();
+    // The XON may have been among what was thrown away
+    m_pacing.released();
+}
+
+bool C45BPort::prepareRetry(const FlashPlan& plan, int i)
+{
+    resync();
+    // The bootloader may have lost track of the segment as well
+    const int segment = plan.segmentRecord(i);
+    if ((segment < 0) || (segment == i))
+        return true;
+    return downloadLine(plan.text(segment), plan.record(segment).length);
+}
+
+bool C45BPort::downloadLines(const FlashPlan& plan, int window, quint32& failedLine)
+{
+    const bool autoWindow = (window == AutoWindow);
+    if (autoWindow && (m_roundTripUs >= 0))
+        m_pacing.addRoundTrip(m_roundTripUs);
+    window = autoWindow ? m_pacing.window(MaxWindow) : qMax(window, 1);
+    const int count = plan.recordCount();
+    int sent = 0;
+    int acked = 0;
+    // Record being retried, and how many times
+    int retried = -1;
+    int attempts = 0;
+    // Send time (in us) of each outstanding record
+    const int slots = autoWindow ? MaxWindow : window;
+    QVector<qint64> sentAt(slots);
+    // Time (in us) of the last replies, or -1 after a page write
+    qint64 lastAck = -1;
+    QElapsedTimer clock;
+    clock.start();
+    QElapsedTimer t;
+    t.start();
+    QElapsedTimer busy;
+    while (acked < count)
+    {
+        // Keep the window full. The records are handed over in one go, so a
+        // network transport can send them in as few packets as possible.
+        bool queued = false;
+        while ((sent < count) && (sent - acked < window))
+        {
+            // The bootloader leaves programming mode at the end of file record, after
+            // which nothing can be resent, so that waits for everything else
+            if ((plan.record(sent).type == FlashPlan::EndOfFile) && (acked < sent))
+                break;
+            if (queued && (m_pacing.recordDelay() > 0))
+            {
+                flush();
+                queued = false;
+            }
+            pace();
+            busy.start();
+            if (sent == acked)
+                // Nothing outstanding, so the timeout runs from now
+                t.start();
+            sentAt[sent % slots] = clock.nsecsElapsed()/1000;
+            write(plan.text(sent), plan.record(sent).length);
+            ++sent;
+            queued = true;
+            ++m_stats.records;
+            m_stats.transmitNs += busy.nsecsElapsed();
+        }
+        if (queued)
+        {
+            busy.start();
+            flush();
+            m_stats.transmitNs += busy.nsecsElapsed();
+        }
+
+        bool ok = true;
+        busy.start();
+        const int timeout = m_pacing.ackTimeout();
+        const bool gotData = !m_rxBuffer.isEmpty() || fillBuffer(remainingTime(t, timeout));
+        m_stats.waitNs += busy.nsecsElapsed();
+        if (!gotData && (t.elapsed() < timeout))
+            continue;
+
+        // Match each reply to the oldest outstanding record
+        const QByteArray r = m_rxBuffer.read(m_rxBuffer.size());
+        const qint64 now = clock.nsecsElapsed()/1000;
+        // Ordinary records acknowledged, whether the first of them was sent before the
+        // previous replies arrived, and whether any page was written
+        int replies = 0;
+        bool backToBack = false;
+        bool pageWrites = false;
+        for (int i = 0; ok && (i < r.size()); ++i)
+        {
+            switch (r[i])
+            {
+            case '.':
+            case '*':
+                if (acked >= sent)
+                {
+                    if (m_verbose)
+                        cout << "Unexpected reply: " << FormatControlChars(r).toStdString() << endl;
+                    ok = false;
+                    break;
+                }
+                if ((r[i] == '.') && (plan.pageCount() > 0) && (plan.expectedReply(acked) == '*'))
+                {
+                    // A reply went missing, so the rest no longer line up with the records.
+                    // ('*' can come early, when a resend makes the bootloader write the
+                    // page it had started.)
+                    if (m_verbose)
+                        cout << "Reply out of step: " << FormatControlChars(r).toStdString() << endl;
+                    ok = false;
+                    break;
+                }
+                {
+                    const qint64 latency = now - sentAt[acked % slots];
+                    m_pacing.acknowledged(latency, r[i] == '*');
+                    if (r[i] == '*')
+                        pageWrites = true;
+                    else
+                    {
+                        m_pacing.addRoundTrip(latency);
+                        if (!replies++)
+                            backToBack = (lastAck >= 0) && (now - latency <= lastAck);
+                    }
+                }
+                if (m_observer)
+                    m_observer->recordAcknowledged(plan, acked, r[i]);
+                ++acked;
+                t.start();
+                // '*' means page write
+                if (m_verbose && (r[i] == '*'))
+                    std::cout << "+" << std::flush;
+                break;
+
+            case '-':
+                if (m_verbose)
+                    cout << "Record rejected: " << FormatControlChars(r).toStdString() << endl;
+                ok = false;
+                break;
+
+            case XOFF:
+                m_pacing.throttled();
+                break;
+
+            case XON:
+                m_pacing.released();
+                break;
+
+            default:
+                // Line endings
+                break;
+            }
+        }
+        if (replies || pageWrites)
+        {
+            // Replies to records that were queued up behind others come as fast as
+            // records can get through
+            if (backToBack && !pageWrites)
+                m_pacing.ackInterval((now - lastAck)/replies);
+            lastAck = pageWrites ? -1 : now;
+            if (autoWindow)
+                window = m_pacing.window(MaxWindow);
+        }
+        // t only restarts on an acknowledgement, so a line full of noise times out too
+        if (ok && (t.elapsed() >= timeout))
+        {
+            m_pacing.timedOut();
+            if (m_verbose)
+                cout << "Timeout" << endl;
+            ok = false;
+        }
+        if (ok)
+            continue;
+
+        // Go back to the start of the page that holds the oldest unacknowledged record,
+        // as the bootloader starts that page afresh
+        const int restart = plan.pageStart(acked);
+        if (restart != retried)
+        {
+            retried = restart;
+            attempts = 0;
+        }
+        do
+        {
+            if (++attempts > m_retryLimit)
+            {
+                failedLine = acked+1;
+                return false;
+            }
+            ++m_stats.retries;
+            if (m_verbose)
+                cout << "Retrying from record " << (restart+1) << endl;
+        }
+        while (!prepareRetry(plan, restart));
+        sent = acked = restart;
+        lastAck = -1;
+        t.start();
+    }
     return true;
 }
@@ -15,30 +15,205 @@
 // You should have received a copy of the GNU General Public License
 // along with c45b.  If not, see <http://www.gnu.org/licenses/>.
 
-#include <QtSerialPort/qserialport.h>
+#ifndef c45b_serport_h
+#define c45b_serport_h
 
-class C45BSerialPort : public QSerialPort
+#include <QByteArray>
+
+#include "flashplan.h"
+#include "pacing.h"
+#include "ringbuffer.h"
+#include "transport.h"
+
+class HexWriter;
+
+/// Time spent on the wire while downloading hex records.
+struct TransferStats
+{
+    TransferStats() : records(0), retries(0), transmitNs(0), waitNs(0), delayNs(0) {}
+
+    quint32 records;
+    /// Number of times a record was sent again after a bad or missing reply
+    quint32 retries;
+    /// Time spent handing records to the port driver. The time they take on the
+    /// line is part of waitNs.
+    qint64 transmitNs;
+    /// Time spent waiting for the bootloader to acknowledge records
+    qint64 waitNs;
+    /// Time spent pacing records
+    qint64 delayNs;
+};
+
+/// Is told about progress while hex records are downloaded.
+class DownloadObserver
+{
+public:
+    virtual ~DownloadObserver() {}
+
+    /// Record i of plan has been acknowledged with reply: '.', or '*' if the bootloader
+    /// wrote a page.
+    virtual void recordAcknowledged(const FlashPlan& plan, int i, char reply) = 0;
+};
+
+/// Talks to chip45boot2 over a Transport.
+class C45BPort
 {
 public:
     static const char XON  = 0x11;
     static const char XOFF = 0x13;
 
-    C45BSerialPort(QString device,
-                   bool verbose);
+    /// How many ms to wait for a record to be acknowledged
+    static const int AckTimeout = 1000;
+
+    /// How many ms readUntil() waits by default
+    static const int ReadTimeout = 1000;
 
-    ~C45BSerialPort();
+    /// How many times a record is resent by default
+    static const int DefaultRetryLimit = 3;
+
+    /// Window size that makes downloadLines() and readEeprom() size the window from
+    /// the round trip time and the rate at which replies arrive
+    static const int AutoWindow = 0;
+
+    /// Largest window used with AutoWindow
+    static const int MaxWindow = 64;
+
+    /// The port takes ownership of transport.
+    C45BPort(Transport* transport,
+             bool verbose);
+
+    ~C45BPort();
+
+    /// Modem control lines that can reset the device
+    enum ResetLine
+    {
+        ResetNone = 0,
+        ResetDtr = 1,
+        ResetRts = 2
+    };
 
     /// 0: Use default
     bool init(int baudRate = 0);
 
-    /// Read until a character equal to c has been read, or until maxSize characters have been read.
+    bool setBaudRate(int baudRate) { return m_transport->setBaudRate(baudRate); }
+
+    void close() { m_transport->close(); }
+
+    QString errorString() const { return m_transport->errorString(); }
+
+    Transport* transport() const { return m_transport; }
+
+    /// Send data without waiting for it to be sent.
+    qint64 write(const char* data, qint64 length) { return m_transport->write(data, length); }
+
+    qint64 write(const QByteArray& data) { return write(data.constData(), data.size()); }
+
+    bool putChar(char c) { return write(&c, 1) == 1; }
+
+    void flush() { m_transport->flush(); }
+
+    /// Drive the selected lines (a combination of ResetLine values) to their active
+    /// level for pulseMs ms, then release them.
+    void pulseReset(int lines, bool activeHigh, int pulseMs);
+
+    /// Read until a character equal to c has been read, until maxSize characters have been read,
+    /// or until timeout ms have passed.
     /// The c character is not included in the returned data.
-    QByteArray readUntil(char c, qint64 maxSize);
+    QByteArray readUntil(char c, qint64 maxSize, int timeout = ReadTimeout);
+
+    /// Return (and consume) all data received so far.
+    QByteArray readAvailable();
+
+    /// Return the number of received bytes not yet consumed.
+    qint64 bufferedBytes();
+
+    /// Wait up to timeout ms for data to arrive. Return true if there is unconsumed data.
+    bool waitForData(int timeout);
+
+    /// Measure the time it takes the bootloader to answer an empty line, taking the
+    /// shortest of 'samples' attempts. Must be called at the prompt.
+    /// Return the round trip time in us, or -1 if there was no answer.
+    qint64 measureRoundTrip(int samples);
+
+    /// Shortest round trip (in us) measured by measureRoundTrip(), or -1.
+    qint64 roundTrip() const { return m_roundTripUs; }
+
+    /// Send one hex record and wait for it to be acknowledged.
+    /// If o_reply is given, it is set to the acknowledgement ('.' or '*').
+    bool downloadLine(const char* record, int length, char* o_reply = 0);
+
+    /// Send record i of plan and wait for it to be acknowledged.
+    /// After a bad or missing reply, resynchronise and send the page that holds it again,
+    /// up to retryLimit() times.
+    bool downloadRecord(const FlashPlan& plan, int i);
+
+    /// Download the records of plan, keeping up to 'window' records in flight.
+    /// The records filling the window are handed to the transport in one go.
+    /// Each '.', '*' or '-' reply acknowledges the oldest outstanding record.
+    /// After a bad or missing reply, resynchronise and resume from the start of the page
+    /// that holds the oldest unacknowledged record, up to retryLimit() times per page.
+    /// On failure, failedLine is set to the (1-based) number of the offending record.
+    bool downloadLines(const FlashPlan& plan, int window, quint32& failedLine);
+
+    /// How many times to resend a record before giving up
+    int retryLimit() const { return m_retryLimit; }
+
+    void setRetryLimit(int limit) { m_retryLimit = limit; }
 
-    bool downloadLine(QString s);
+    /// Report acknowledged records to observer (0: none). The observer is not owned.
+    void setObserver(DownloadObserver* observer) { m_observer = observer; }
+
+    /// Read length bytes of EEPROM starting at address, keeping up to 'window' 'er'
+    /// requests in flight. The replies are matched to the requests in order.
+    /// With AutoWindow, the window is sized from what has been measured so far.
+    bool readEeprom(quint32 address, quint32 length, int window, QByteArray& o_data);
+
+    /// As above, but write each record to writer (and flush it) as soon as it is complete.
+    /// If reading fails, the bytes received so far are still written.
+    bool readEeprom(quint32 address, quint32 length, int window, HexWriter& writer);
+
+    const TransferStats& stats() const { return m_stats; }
+
+    void resetStats() { m_stats = TransferStats(); }
+
+    PacingController& pacing() { return m_pacing; }
 
 private:
+    /// Wait the delay requested by the pacing controller.
+    void pace();
+
+    /// Get back in step with the bootloader after a bad or missing reply:
+    /// Wait until it stops sending and discard everything received.
+    void resync();
+
+    /// Prepare to resend record i: resynchronise, and resend the extended segment
+    /// record that applies to it. Return false if that fails.
+    bool prepareRetry(const FlashPlan& plan, int i);
+
+    /// Move data from the port to the receive buffer, waiting up to timeout ms for data to arrive.
+    /// Return false if no data was available.
+    bool fillBuffer(int timeout);
+
+    /// Implements readEeprom(). If writer is set, complete records are written and
+    /// removed from o_data. o_received is set to the number of bytes received.
+    bool readEeprom(quint32 address, quint32 length, int window, QByteArray& o_data,
+                    HexWriter* writer, quint32& o_received);
+
+    /// Read one line of text, without line ending, XON and XOFF.
+    /// Return false if no complete line arrived within timeout ms.
+    bool readLine(QByteArray& line, int timeout);
+
+    /// Read until an acknowledgement ('.', '*' or '-') has been received, or until the timeout expires.
+    QByteArray readReply(int timeout);
+
+    Transport* m_transport;
     bool m_verbose;
+    int m_retryLimit;
+    DownloadObserver* m_observer;
+    qint64 m_roundTripUs;
+    TransferStats m_stats;
+    PacingController m_pacing;
+    RingBuffer m_rxBuffer;
 };
 
-    
+#endif
@@ -0,0 +1,233 @@
+// Copyright 2012 Torsten Martinsen <bullestock@bullestock.net>
+
+// This file is part of c45b.
+
+// c45b is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// c45b is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with c45b.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <QtGlobal>
+
+#include "hexcodec.h"
+#include "serport.h"
+#include "simbootloader.h"
+
+const char DefaultSimulatedPart[] = "atmega328p";
+
+static const char Greeting[] = "c45b2 v2.9 (simulated)\n\r";
+
+static const char Prompt[] = "\n\r>";
+
+SimBootloader::SimBootloader(const DeviceProfile& profile)
+    : m_profile(profile),
+      m_flash(profile.flashBytes, static_cast<char>(0xFF)),
+      m_eeprom(profile.eepromBytes, static_cast<char>(0xFF))
+{
+    if (m_profile.pageSize <= 0)
+        m_profile.pageSize = 128;
+    reset();
+}
+
+void SimBootloader::reset()
+{
+    m_state = Listening;
+    m_syncCount = 0;
+    m_line.clear();
+    m_pageAddress = -1;
+}
+
+int SimBootloader::receive(char c, QByteArray& o_reply)
+{
+    switch (m_state)
+    {
+    case Listening:
+        // The bootloader measures the baud rate from four 'U'
+        m_syncCount = (c == 'U') ? m_syncCount + 1 : 0;
+        if (m_syncCount == 4)
+        {
+            o_reply.append(Greeting);
+            o_reply.append(C45BPort::XON);
+            m_state = Command;
+            m_line.clear();
+        }
+        return 0;
+
+    case Command:
+        if (c == '\r')
+            return 0;
+        if (c != '\n')
+        {
+            // Commands are echoed
+            o_reply.append(c);
+            m_line.append(c);
+            return 0;
+        }
+        command(o_reply);
+        m_line.clear();
+        return 0;
+
+    case Programming:
+        if (c == '\r')
+            return 0;
+        if (c != '\n')
+        {
+            m_line.append(c);
+            return 0;
+        }
+        {
+            // The bootloader holds us off while it handles the record
+            o_reply.append(C45BPort::XOFF);
+            const int busyUs = record(o_reply);
+            o_reply.append(C45BPort::XON);
+            m_line.clear();
+            return busyUs;
+        }
+    }
+    return 0;
+}
+
+void SimBootloader::command(QByteArray& o_reply)
+{
+    if (m_line.isEmpty())
+    {
+        o_reply.append(Prompt);
+        return;
+    }
+    o_reply.append(C45BPort::XOFF);
+    if ((m_line == "pf") || (m_line == "pe"))
+    {
+        o_reply.append("+\r\n");
+        m_state = Programming;
+        m_programFlash = (m_line == "pf");
+        m_segment = 0;
+        m_pageAddress = -1;
+    }
+    else if (m_line.startsWith("er") && (m_line.size() == 6))
+    {
+        bool ok = false;
+        const uint address = m_line.mid(2).toUInt(&ok, 16);
+        if (!ok || (address >= static_cast<uint>(m_eeprom.size())))
+        {
+            o_reply.append("-").append(Prompt);
+        }
+        else
+        {
+            char value[8];
+            qsnprintf(value, sizeof(value), "%02x\r\n", static_cast<quint8>(m_eeprom.at(address)));
+            o_reply.append("+\r\n").append(value).append(Prompt);
+        }
+    }
+    else if (m_line == "g")
+    {
+        // Start the application, which does not talk to us
+        o_reply.append("+\r\n");
+        m_state = Listening;
+        m_syncCount = 0;
+    }
+    else
+        o_reply.append("-").append(Prompt);
+    o_reply.append(C45BPort::XON);
+}
+
+int SimBootloader::record(QByteArray& o_reply)
+{
+    quint8 data[256];
+    quint8 header[4];
+    quint8 checkSum = 0;
+    const int length = m_line.size();
+    if ((length < 11) || (m_line.at(0) != ':') ||
+        (HexCodec::decode(m_line.constData() + 1, 4, header, checkSum) >= 0) ||
+        (length != 11 + 2*header[0]) ||
+        (HexCodec::decode(m_line.constData() + 9, header[0] + 1, data, checkSum) >= 0) ||
+        checkSum)
+    {
+        o_reply.append('-');
+        return 0;
+    }
+    const int byteCount = header[0];
+    const quint32 address = (header[1] << 8) + header[2];
+    int busyUs = 0;
+    switch (header[3])
+    {
+    case 0:
+        {
+            const quint32 start = address + 16*m_segment;
+            for (int i = 0; i < byteCount; ++i)
+                if (!store(start + i, data[i], busyUs))
+                {
+                    o_reply.append('-');
+                    return busyUs;
+                }
+            // A record that fills the page makes the bootloader write it
+            if (m_programFlash && ((start + byteCount) % m_profile.pageSize == 0))
+                busyUs += commitPage();
+        }
+        break;
+
+    case 1:
+        // End of file: Write what is left, and go back to the prompt
+        if (m_programFlash)
+            busyUs += commitPage();
+        m_state = Command;
+        break;
+
+    case 2:
+        if (byteCount != 2)
+        {
+            o_reply.append('-');
+            return 0;
+        }
+        m_segment = (data[0] << 8) + data[1];
+        break;
+
+    default:
+        o_reply.append('-');
+        return 0;
+    }
+    // '*' tells that a page was written
+    o_reply.append(busyUs ? '*' : '.');
+    return busyUs;
+}
+
+bool SimBootloader::store(quint32 address, quint8 value, int& o_busyUs)
+{
+    if (!m_programFlash)
+    {
+        if (address >= static_cast<quint32>(m_eeprom.size()))
+            return false;
+        m_eeprom[address] = static_cast<char>(value);
+        return true;
+    }
+    if ((address >= static_cast<quint32>(m_flash.size())) ||
+        (m_profile.bootStart && (address >= m_profile.bootStart)))
+        return false;
+    const quint32 page = address - address % m_profile.pageSize;
+    if (m_pageAddress != page)
+    {
+        o_busyUs += commitPage();
+        // The page is erased before it is written
+        m_page.fill(static_cast<char>(0xFF), m_profile.pageSize);
+        m_pageAddress = page;
+    }
+    m_page[address - page] = static_cast<char>(value);
+    return true;
+}
+
+int SimBootloader::commitPage()
+{
+    if (m_pageAddress < 0)
+        return 0;
+    m_flash.replace(static_cast<int>(m_pageAddress), m_page.size(), m_page);
+    m_pageAddress = -1;
+    // A page write takes some time, even if the profile does not say how long
+    return qMax(m_profile.pageWriteUs, 1);
+}
@@ -0,0 +1,84 @@
+// Copyright 2012 Torsten Martinsen <bullestock@bullestock.net>
+
+// This file is part of c45b.
+
+// c45b is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// c45b is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with c45b.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef c45b_simbootloader_h
+#define c45b_simbootloader_h
+
+#include <QByteArray>
+
+#include "deviceprofile.h"
+#include "loopbacktransport.h"
+
+/// Part simulated when none is given
+extern const char DefaultSimulatedPart[];
+
+/// Simulates chip45boot2 on the device described by a profile, well enough to connect,
+/// program flash and EEPROM, and read EEPROM. The memories are kept in RAM.
+/// Each page write keeps the bootloader busy for the profile's page write time.
+class SimBootloader : public LoopbackPeer
+{
+public:
+    SimBootloader(const DeviceProfile& profile);
+
+    virtual int receive(char c, QByteArray& o_reply);
+
+    /// Restart the bootloader. The memories keep their contents.
+    virtual void reset();
+
+    const QByteArray& flash() const { return m_flash; }
+
+    const QByteArray& eeprom() const { return m_eeprom; }
+
+private:
+    enum State
+    {
+        /// Waiting for "UUUU"
+        Listening,
+        /// At the prompt
+        Command,
+        /// Receiving hex records after 'pf' or 'pe'
+        Programming
+    };
+
+    /// Handle the command in m_line.
+    void command(QByteArray& o_reply);
+
+    /// Handle the hex record in m_line. Return the time spent, in us.
+    int record(QByteArray& o_reply);
+
+    /// Store one byte of a data record. Return false if the address is out of range.
+    bool store(quint32 address, quint8 value, int& o_busyUs);
+
+    /// Write the page buffer to flash, if it holds a page. Return the time spent, in us.
+    int commitPage();
+
+    DeviceProfile m_profile;
+    QByteArray m_flash;
+    QByteArray m_eeprom;
+    State m_state;
+    /// Number of consecutive 'U' received while listening
+    int m_syncCount;
+    QByteArray m_line;
+    /// True when programming flash, false when programming EEPROM
+    bool m_programFlash;
+    quint32 m_segment;
+    /// Start of the page in the page buffer, or -1 if it is empty
+    qint64 m_pageAddress;
+    QByteArray m_page;
+};
+
+#endif
@@ -0,0 +1,85 @@
+// Copyright 2012 Torsten Martinsen <bullestock@bullestock.net>
+
+// This file is part of c45b.
+
+// c45b is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// c45b is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with c45b.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <iostream>
+
+#include <QTcpSocket>
+
+#include "simbootloader.h"
+#include "simserver.h"
+
+using namespace std;
+
+// How long (ms) to wait for the client when no reply is on its way
+static const int IdleWait = 100;
+
+SimServer::SimServer(const DeviceProfile& profile, int baudRate)
+    : m_line(new SimBootloader(profile)),
+      m_baudRate(baudRate)
+{
+}
+
+bool SimServer::listen(quint16 port)
+{
+    if (!m_server.listen(QHostAddress::LocalHost, port))
+    {
+        m_lastError = m_server.errorString();
+        return false;
+    }
+    return true;
+}
+
+void SimServer::run(bool verbose)
+{
+    while (m_server.waitForNewConnection(-1))
+    {
+        QTcpSocket* socket = m_server.nextPendingConnection();
+        if (!socket)
+            continue;
+        if (verbose)
+            cout << "Client connected" << endl;
+        serve(socket);
+        delete socket;
+        if (verbose)
+            cout << "Client disconnected" << endl;
+    }
+    m_lastError = m_server.errorString();
+}
+
+void SimServer::serve(QTcpSocket* socket)
+{
+    socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+    // A new connection finds the bootloader freshly started
+    m_line.peer()->reset();
+    m_line.open(m_baudRate);
+    char buffer[4096];
+    while (socket->state() == QAbstractSocket::ConnectedState)
+    {
+        // Forward replies that have made it across the line
+        qint64 n;
+        while ((n = m_line.read(buffer, sizeof(buffer))) > 0)
+            socket->write(buffer, n);
+        socket->flush();
+
+        // Wait for the client, but not beyond the next reply
+        if (!socket->bytesAvailable() && !socket->waitForReadyRead(m_line.hasPending() ? 1 : IdleWait))
+            continue;
+        while ((n = socket->read(buffer, sizeof(buffer))) > 0)
+            m_line.write(buffer, n);
+    }
+    m_line.close();
+}
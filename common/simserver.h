@@ -0,0 +1,57 @@
+// Copyright 2012 Torsten Martinsen <bullestock@bullestock.net>
+
+// This file is part of c45b.
+
+// c45b is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// c45b is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with c45b.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef c45b_simserver_h
+#define c45b_simserver_h
+
+#include <QTcpServer>
+
+#include "deviceprofile.h"
+#include "loopbacktransport.h"
+
+class QTcpSocket;
+
+/// Serves a simulated bootloader on a local TCP port, like a serial-over-TCP server
+/// with a device attached. Connections are served one at a time; the memories of the
+/// device are kept between connections.
+class SimServer
+{
+public:
+    /// baudRate: Speed of the simulated serial line behind the server (0: No delay)
+    SimServer(const DeviceProfile& profile, int baudRate);
+
+    /// Listen on 127.0.0.1:port (0: Any free port).
+    bool listen(quint16 port);
+
+    quint16 port() const { return m_server.serverPort(); }
+
+    /// Serve connections until accepting one fails.
+    void run(bool verbose);
+
+    QString errorString() const { return m_lastError; }
+
+private:
+    /// Pass data between the client and the simulated line until the client disconnects.
+    void serve(QTcpSocket* socket);
+
+    LoopbackTransport m_line;
+    int m_baudRate;
+    QTcpServer m_server;
+    QString m_lastError;
+};
+
+#endif
@@ -0,0 +1,76 @@
+// Copyright 2012 Torsten Martinsen <bullestock@bullestock.net>
+
+// This file is part of c45b.
+
+// c45b is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// c45b is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with c45b.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "tcptransport.h"
+
+TcpTransport::TcpTransport(const QString& host, quint16 port)
+    : m_host(host),
+      m_port(port)
+{
+}
+
+bool TcpTransport::open(int)
+{
+    m_socket.connectToHost(m_host, m_port);
+    if (!m_socket.waitForConnected(ConnectTimeout))
+        return false;
+    // Records are small and each one waits for a reply, so do not let Nagle hold them back
+    m_socket.setSocketOption(QAbstractSocket::LowDelayOption, 1);
+    return true;
+}
+
+void TcpTransport::close()
+{
+    m_socket.disconnectFromHost();
+    if (m_socket.state() != QAbstractSocket::UnconnectedState)
+        m_socket.waitForDisconnected(ConnectTimeout);
+}
+
+qint64 TcpTransport::write(const char* data, qint64 length)
+{
+    return m_socket.write(data, length);
+}
+
+void TcpTransport::flush()
+{
+    m_socket.flush();
+}
+
+bool TcpTransport::waitForBytesWritten(int timeout)
+{
+    return !m_socket.bytesToWrite() || m_socket.waitForBytesWritten(timeout);
+}
+
+qint64 TcpTransport::bytesAvailable()
+{
+    return m_socket.bytesAvailable();
+}
+
+bool TcpTransport::waitForReadyRead(int timeout)
+{
+    return m_socket.waitForReadyRead(timeout);
+}
+
+qint64 TcpTransport::read(char* data, qint64 maxLength)
+{
+    return m_socket.read(data, maxLength);
+}
+
+QString TcpTransport::errorString() const
+{
+    return m_socket.errorString();
+}
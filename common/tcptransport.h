@@ -0,0 +1,52 @@
+// Copyright 2012 Torsten Martinsen <bullestock@bullestock.net>
+
+// This file is part of c45b.
+
+// c45b is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// c45b is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with c45b.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef c45b_tcptransport_h
+#define c45b_tcptransport_h
+
+#include <QTcpSocket>
+
+#include "transport.h"
+
+/// A raw TCP connection, e.g. to a serial-over-TCP server.
+/// The bit rate and the modem lines are controlled by the server, so they are ignored.
+class TcpTransport : public Transport
+{
+public:
+    /// How many ms to wait for the connection to be established
+    static const int ConnectTimeout = 5000;
+
+    TcpTransport(const QString& host, quint16 port);
+
+    virtual bool needsApplication() const { return true; }
+    virtual bool open(int baudRate);
+    virtual void close();
+    virtual qint64 write(const char* data, qint64 length);
+    virtual void flush();
+    virtual bool waitForBytesWritten(int timeout);
+    virtual qint64 bytesAvailable();
+    virtual bool waitForReadyRead(int timeout);
+    virtual qint64 read(char* data, qint64 maxLength);
+    virtual QString errorString() const;
+
+private:
+    QString m_host;
+    quint16 m_port;
+    QTcpSocket m_socket;
+};
+
+#endif
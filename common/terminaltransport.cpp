@@ -0,0 +1,266 @@
+// Copyright 2012 Torsten Martinsen <bullestock@bullestock.net>
+
+// This file is part of c45b.
+
+// c45b is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// c45b is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with c45b.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <errno.h>
+#include <string.h>
+
+#ifndef _WIN32
+#  include <fcntl.h>
+#  include <poll.h>
+#  include <sys/ioctl.h>
+#  include <termios.h>
+#  include <unistd.h>
+#endif
+
+#include <QElapsedTimer>
+
+#include "terminaltransport.h"
+
+TerminalTransport::TerminalTransport(const QString& path)
+    : m_path(path),
+      m_fd(-1)
+{
+}
+
+TerminalTransport::~TerminalTransport()
+{
+    close();
+}
+
+void TerminalTransport::setError(const char* what)
+{
+    m_lastError = QString("%1: %2").arg(what).arg(strerror(errno));
+}
+
+#ifdef _WIN32
+
+bool TerminalTransport::open(int)
+{
+    m_lastError = "Terminal devices are not supported on this platform";
+    return false;
+}
+
+bool TerminalTransport::configure(struct termios&, int)
+{
+    return false;
+}
+
+void TerminalTransport::close()
+{
+}
+
+qint64 TerminalTransport::write(const char*, qint64)
+{
+    return -1;
+}
+
+void TerminalTransport::flush()
+{
+}
+
+bool TerminalTransport::waitForBytesWritten(int)
+{
+    return false;
+}
+
+qint64 TerminalTransport::bytesAvailable()
+{
+    return 0;
+}
+
+bool TerminalTransport::waitForReadyRead(int)
+{
+    return false;
+}
+
+qint64 TerminalTransport::read(char*, qint64)
+{
+    return -1;
+}
+
+int TerminalTransport::poll(int, int)
+{
+    return 0;
+}
+
+bool TerminalTransport::writeOutgoing()
+{
+    return false;
+}
+
+#else
+
+bool TerminalTransport::open(int baudRate)
+{
+    m_fd = ::open(m_path.toLocal8Bit().constData(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (m_fd < 0)
+    {
+        setError("Cannot open terminal");
+        return false;
+    }
+    struct termios tio;
+    if (tcgetattr(m_fd, &tio) < 0)
+    {
+        setError("Not a terminal");
+        close();
+        return false;
+    }
+    if (!configure(tio, baudRate))
+    {
+        close();
+        return false;
+    }
+    if (tcsetattr(m_fd, TCSANOW, &tio) < 0)
+    {
+        setError("Cannot set terminal attributes");
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool TerminalTransport::configure(struct termios& tio, int)
+{
+    cfmakeraw(&tio);
+    return true;
+}
+
+void TerminalTransport::close()
+{
+    if (m_fd >= 0)
+        ::close(m_fd);
+    m_fd = -1;
+    m_outgoing.clear();
+}
+
+int TerminalTransport::poll(int events, int timeout)
+{
+    if (m_fd < 0)
+        return 0;
+    struct pollfd p;
+    p.fd = m_fd;
+    p.events = events;
+    p.revents = 0;
+    QElapsedTimer t;
+    t.start();
+    while (true)
+    {
+        const int n = ::poll(&p, 1, qMax(0, timeout - static_cast<int>(t.elapsed())));
+        if (n > 0)
+            return p.revents & events;
+        if ((n == 0) || (errno != EINTR))
+            return 0;
+    }
+}
+
+bool TerminalTransport::writeOutgoing()
+{
+    int written = 0;
+    while (written < m_outgoing.size())
+    {
+        const ssize_t n = ::write(m_fd, m_outgoing.constData() + written, m_outgoing.size() - written);
+        if (n > 0)
+            written += n;
+        else if ((n < 0) && (errno == EINTR))
+            continue;
+        else if ((n < 0) && (errno != EAGAIN))
+        {
+            setError("Write failed");
+            return false;
+        }
+        else
+            break;
+    }
+    m_outgoing.remove(0, written);
+    return true;
+}
+
+qint64 TerminalTransport::write(const char* data, qint64 length)
+{
+    if (m_fd < 0)
+        return -1;
+    // Keep the order: Nothing goes straight to the driver while older data waits
+    m_outgoing.append(data, static_cast<int>(length));
+    if (!writeOutgoing())
+        return -1;
+    return length;
+}
+
+void TerminalTransport::flush()
+{
+    writeOutgoing();
+}
+
+bool TerminalTransport::waitForBytesWritten(int timeout)
+{
+    // Only wait until everything has been handed to the driver. QSerialPort stops
+    // waiting at the same point, so the time spent on the line is counted as
+    // waiting for the reply with either backend. tcdrain() would wait for the
+    // line as well, but it cannot time out.
+    QElapsedTimer t;
+    t.start();
+    while (true)
+    {
+        if (!writeOutgoing())
+            return false;
+        if (m_outgoing.isEmpty())
+            return m_fd >= 0;
+        if (!poll(POLLOUT, qMax(0, timeout - static_cast<int>(t.elapsed()))))
+            return false;
+    }
+}
+
+qint64 TerminalTransport::bytesAvailable()
+{
+    int n = 0;
+    if ((m_fd < 0) || (ioctl(m_fd, FIONREAD, &n) < 0))
+        return 0;
+    return n;
+}
+
+bool TerminalTransport::waitForReadyRead(int timeout)
+{
+    // Keep sending while waiting, as the reply may depend on it
+    QElapsedTimer t;
+    t.start();
+    while (true)
+    {
+        if (!writeOutgoing())
+            return false;
+        const int remaining = qMax(0, timeout - static_cast<int>(t.elapsed()));
+        if (m_outgoing.isEmpty())
+            return poll(POLLIN, remaining) != 0;
+        const int events = poll(POLLIN | POLLOUT, remaining);
+        if (events & POLLIN)
+            return true;
+        if (!events)
+            return false;
+    }
+}
+
+qint64 TerminalTransport::read(char* data, qint64 maxLength)
+{
+    const ssize_t n = ::read(m_fd, data, maxLength);
+    if (n >= 0)
+        return n;
+    if ((errno == EAGAIN) || (errno == EINTR))
+        return 0;
+    setError("Read failed");
+    return -1;
+}
+
+#endif
@@ -0,0 +1,72 @@
+// Copyright 2012 Torsten Martinsen <bullestock@bullestock.net>
+
+// This file is part of c45b.
+
+// c45b is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// c45b is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with c45b.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef c45b_terminaltransport_h
+#define c45b_terminaltransport_h
+
+#include <QByteArray>
+
+#include "transport.h"
+
+struct termios;
+
+/// A POSIX terminal device, read and written without blocking and waited for with poll().
+/// The terminal is put in raw mode, which is all a pseudo-terminal needs, e.g. one end
+/// of a pair made by
+///   socat pty,raw,echo=0,link=/tmp/c45b pty,raw,echo=0,link=/tmp/device
+/// Subclasses can set up the line further. Only available on POSIX systems.
+class TerminalTransport : public Transport
+{
+public:
+    TerminalTransport(const QString& path);
+
+    ~TerminalTransport();
+
+    virtual bool open(int baudRate);
+    virtual void close();
+    virtual qint64 write(const char* data, qint64 length);
+    virtual void flush();
+    virtual bool waitForBytesWritten(int timeout);
+    virtual qint64 bytesAvailable();
+    virtual bool waitForReadyRead(int timeout);
+    virtual qint64 read(char* data, qint64 maxLength);
+    virtual QString errorString() const { return m_lastError; }
+
+protected:
+    /// Adjust the terminal settings before open() applies them.
+    /// Return false (after calling setError()) to make open() fail.
+    virtual bool configure(struct termios& tio, int baudRate);
+
+    /// Wait up to timeout ms for any of events (POLLIN, POLLOUT) on the terminal.
+    /// Return the events that occurred, or 0 on timeout or error.
+    int poll(int events, int timeout);
+
+    /// Hand as much of m_outgoing to the driver as it takes without blocking.
+    /// Return false on error.
+    bool writeOutgoing();
+
+    /// Set the error string from what and errno.
+    void setError(const char* what);
+
+    QString m_path;
+    int m_fd;
+    /// Data accepted by write() that the driver had no room for yet
+    QByteArray m_outgoing;
+    QString m_lastError;
+};
+
+#endif
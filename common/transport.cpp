@@ -0,0 +1,88 @@
+// Copyright 2012 Torsten Martinsen <bullestock@bullestock.net>
+
+// This file is part of c45b.
+
+// c45b is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// c45b is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with c45b.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <QUrl>
+
+#include "deviceprofile.h"
+#include "loopbacktransport.h"
+#include "nativeserialtransport.h"
+#ifndef C45B_NATIVE_SERIAL
+#  include "serialtransport.h"
+#endif
+#include "simbootloader.h"
+#include "tcptransport.h"
+#include "terminaltransport.h"
+#include "transport.h"
+
+bool Transport::setBaudRate(int)
+{
+    return true;
+}
+
+void Transport::setDataTerminalReady(bool)
+{
+}
+
+void Transport::setRequestToSend(bool)
+{
+}
+
+Transport::SerialBackend Transport::defaultBackend()
+{
+#ifdef C45B_NATIVE_SERIAL
+    return NativeBackend;
+#else
+    return QtBackend;
+#endif
+}
+
+Transport* Transport::create(const QString& spec, const DeviceProfiles& profiles,
+                             SerialBackend backend, QString& o_error)
+{
+    if (spec.startsWith("tcp://"))
+    {
+        const QUrl url(spec);
+        const int port = url.port();
+        if (!url.isValid() || url.host().isEmpty() || (port <= 0))
+        {
+            o_error = QString("Invalid TCP address '%1', expected tcp://host:port").arg(spec);
+            return 0;
+        }
+        return new TcpTransport(url.host(), static_cast<quint16>(port));
+    }
+    if (spec.startsWith("pty:"))
+        return new TerminalTransport(spec.mid(4));
+    if ((spec == "loop") || spec.startsWith("loop:"))
+    {
+        const QString part = (spec == "loop") ? QString(DefaultSimulatedPart) : spec.mid(5);
+        const DeviceProfile* profile = profiles.find(part);
+        if (!profile)
+        {
+            o_error = QString("Unknown part '%1'").arg(part);
+            return 0;
+        }
+        return new LoopbackTransport(new SimBootloader(*profile));
+    }
+    if (backend == NativeBackend)
+        return new NativeSerialTransport(spec);
+#ifdef C45B_NATIVE_SERIAL
+    o_error = "This version of c45b was built without QSerialPort";
+    return 0;
+#else
+    return new SerialTransport(spec);
+#endif
+}
@@ -0,0 +1,93 @@
+// Copyright 2012 Torsten Martinsen <bullestock@bullestock.net>
+
+// This file is part of c45b.
+
+// c45b is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// c45b is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with c45b.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef c45b_transport_h
+#define c45b_transport_h
+
+#include <QString>
+
+class DeviceProfiles;
+
+/// A byte stream to the bootloader: A serial port, or something that behaves like one.
+/// All waiting is done in the wait functions; read() and write() do not block.
+class Transport
+{
+public:
+    /// How serial ports are accessed
+    enum SerialBackend
+    {
+        /// QSerialPort
+        QtBackend,
+        /// termios and poll() (POSIX only)
+        NativeBackend
+    };
+
+    virtual ~Transport() {}
+
+    /// Return true if the transport uses Qt classes that need a QCoreApplication.
+    /// The application object must exist before open() is called.
+    virtual bool needsApplication() const { return false; }
+
+    /// Open the link. baudRate is ignored by links that have no bit rate (0: Use default).
+    virtual bool open(int baudRate) = 0;
+
+    virtual void close() = 0;
+
+    /// Change the bit rate of an open link.
+    virtual bool setBaudRate(int baudRate);
+
+    /// Drive the DTR and RTS modem control lines. Links without them ignore this.
+    virtual void setDataTerminalReady(bool on);
+    virtual void setRequestToSend(bool on);
+
+    /// Queue length bytes for sending. Return the number of bytes queued, or -1 on error.
+    virtual qint64 write(const char* data, qint64 length) = 0;
+
+    /// Start sending queued data.
+    virtual void flush() = 0;
+
+    /// Wait up to timeout ms for all queued data to be handed to the driver.
+    /// Serial ports do not wait for the data to go out on the line, the loopback
+    /// transport does.
+    virtual bool waitForBytesWritten(int timeout) = 0;
+
+    /// Return the number of bytes read() can return without waiting.
+    virtual qint64 bytesAvailable() = 0;
+
+    /// Wait up to timeout ms for data to arrive. Return true if there is data to read.
+    virtual bool waitForReadyRead(int timeout) = 0;
+
+    /// Read up to maxLength bytes. Return the number of bytes read, or -1 on error.
+    virtual qint64 read(char* data, qint64 maxLength) = 0;
+
+    virtual QString errorString() const = 0;
+
+    /// Create the transport for a port specification:
+    ///   tcp://HOST:PORT  Raw TCP connection
+    ///   pty:PATH         Pseudo-terminal, e.g. one end of a socat pty pair
+    ///   loop[:PART]      In-memory link to a simulated bootloader for PART (default atmega328p)
+    ///   anything else is the name of a serial port, accessed through backend
+    /// Parts are looked up in profiles. Return 0 and set o_error if the specification is invalid.
+    static Transport* create(const QString& spec, const DeviceProfiles& profiles,
+                             SerialBackend backend, QString& o_error);
+
+    /// The serial backend to use when none is chosen: QtBackend, unless c45b was
+    /// built without QSerialPort (C45B_NATIVE_SERIAL).
+    static SerialBackend defaultBackend();
+};
+
+#endif
@@ -18,7 +18,7 @@
 include(../prefix.pri)
 
 INCLUDEPATH += ../common ../ezOptionParser-0.0.0
-LIBS += -lQt5SerialPort
+QT += network
 
 TARGET = c45b
 
@@ -32,16 +32,57 @@ c45b.files = c45b
 INSTALLS += c45b
 
 HEADERS       = ../common/c45butils.h \
+		../common/checkpoint.h \
+		../common/deviceprofile.h \
+		../common/flashplan.h \
+		../common/hexchunker.h \
+		../common/hexcodec.h \
 		../common/hexfile.h \
 		../common/hexfiletester.h \
 		../common/hexutils.h \
+		../common/hexwriter.h \
+		../common/loopbacktransport.h \
+		../common/nativeserialtransport.h \
+		../common/pagecache.h \
+		../common/pacing.h \
        		../common/platform.h \
+       		../common/ringbuffer.h \
        		../common/serport.h \
+		../common/simbootloader.h \
+		../common/simserver.h \
+		../common/tcptransport.h \
+		../common/terminaltransport.h \
+		../common/transport.h \
                 ../ezOptionParser-0.0.0/ezOptionParser.hpp
 SOURCES       = ../common/c45butils.cpp \
+		../common/checkpoint.cpp \
+		../common/deviceprofile.cpp \
+		../common/flashplan.cpp \
+		../common/hexchunker.cpp \
+		../common/hexcodec.cpp \
 		../common/hexfile.cpp \
 		../common/hexfiletester.cpp \
 		../common/hexutils.cpp \
+		../common/hexwriter.cpp \
+		../common/loopbacktransport.cpp \
+		../common/nativeserialtransport.cpp \
+		../common/pagecache.cpp \
+		../common/pacing.cpp \
 		../common/platform.cpp \
+		../common/ringbuffer.cpp \
 		../common/serport.cpp \
+		../common/simbootloader.cpp \
+		../common/simserver.cpp \
+		../common/tcptransport.cpp \
+		../common/terminaltransport.cpp \
+		../common/transport.cpp \
 		main.cpp
+
+# qmake CONFIG+=native_serial builds without QSerialPort, using termios directly
+native_serial {
+  DEFINES += C45B_NATIVE_SERIAL
+} else {
+  LIBS += -lQt5SerialPort
+  HEADERS += ../common/serialtransport.h
+  SOURCES += ../common/serialtransport.cpp
+}
@@ -18,22 +18,32 @@
 #include <iostream>
 #include <iomanip>
 
-#include <errno.h>
-
 #include <QCoreApplication>
 #include <QDebug>
+#include <QElapsedTimer>
+#include <QScopedPointer>
+#include <QSettings>
+#include <QFile>
 #include <QTextStream>
 #include <QThread>
-#include <QTime>
 
 #include <ezOptionParser.hpp>
 
 #include "c45butils.h"
+#include "checkpoint.h"
+#include "deviceprofile.h"
+#include "flashplan.h"
+#include "hexchunker.h"
 #include "hexfile.h"
 #include "hexfiletester.h"
 #include "hexutils.h"
+#include "hexwriter.h"
+#include "pagecache.h"
 #include "platform.h"
 #include "serport.h"
+#include "simbootloader.h"
+#include "simserver.h"
+#include "transport.h"
 
 using namespace std;
 
@@ -104,37 +114,145 @@ bool parseAppCmd(const std::string& i_str, QByteArray& o_data)
 }
 
 
-bool readEeprom(HexFile& o_hexFile, quint32 eepromReadBytes, C45BSerialPort* port, bool verbose)
+// Characters a record adds besides its data: ":LLAAAATT", checksum and newline
+const int RecordOverhead = 12;
+
+/// Read the EEPROM locations covered by image from the device, and set o_changed
+/// to the bytes of image that differ from the device contents.
+bool diffEeprom(const HexFile& image, C45BPort* port, int window, HexFile& o_changed, bool verbose)
 {
-    for (quint32 i = 0; i < eepromReadBytes; ++i)
+    o_changed.reset();
+    port->readAvailable();
+    const HexFile::Ranges& ranges = image.ranges();
+    for (HexFile::Ranges::const_iterator it = ranges.constBegin(); it != ranges.constEnd(); ++it)
     {
-        QString cmd = QString("er%1").arg(i, 4, 16, QChar('0'));
-        port->write(cmd.toLatin1());
-        port->putChar('\n');
-        QString reply = port->readUntil('\r', 10);
-        reply = reply.replace(QChar(C45BSerialPort::XOFF), "").trimmed();
-        QString expected = cmd + QString("+");
-        if (!reply.startsWith(expected))
-        {
-            cout << "Error: Bootloader did not respond to 'er' command" << endl;
-            if (verbose)
-                cout << "Reply: " << FormatControlChars(reply) << endl;
+        const QByteArray& wanted = it.value();
+        QByteArray current;
+        if (!port->readEeprom(it.key(), wanted.size(), window, current))
             return false;
+        // Collect runs of differing bytes
+        int i = 0;
+        while (i < wanted.size())
+        {
+            if (wanted[i] == current[i])
+            {
+                ++i;
+                continue;
+            }
+            const int start = i;
+            int end = i;
+            while (i < wanted.size())
+            {
+                if (wanted[i] != current[i])
+                    end = ++i;
+                else if (2*(i + 1 - end) < RecordOverhead)
+                    // Rewriting a short gap is cheaper than starting a new record
+                    ++i;
+                else
+                    break;
+            }
+            i = end;
+            if (!o_changed.setRange(it.key() + start, wanted.constData() + start, end - start))
+            {
+                cout << "Error: " << o_changed.errorString() << endl;
+                return false;
+            }
         }
-        reply = port->readUntil('\r', 10);
-        reply = reply.trimmed();
-        if (verbose)
-            cout <<reply<<" ";
-        o_hexFile.append(reply.toInt(0, 16));
-        port->readUntil(C45BSerialPort::XON, 10);
     }
     if (verbose)
-        cout <<endl;
+        cout << o_changed.byteCount() << " of " << image.byteCount() << " EEPROM bytes differ in "
+             << o_changed.ranges().size() << " regions" << endl;
     return true;
 }
 
-bool program(const HexFile& hexFile, C45BSerialPort* port, int delay, bool doFlash, bool verbose)
+/// Parse a decimal number, or a hex number prefixed with 0x.
+bool parseNumber(const std::string& s, quint32& o_value)
+{
+    const QString str = QString::fromStdString(s).trimmed();
+    bool ok = false;
+    if (str.startsWith("0x", Qt::CaseInsensitive))
+        o_value = str.mid(2).toUInt(&ok, 16);
+    else
+        o_value = str.toUInt(&ok, 10);
+    return ok;
+}
+
+bool readEeprom(const QString& fileName, quint32 start, quint32 length, int recordBytes,
+                C45BPort* port, int window, bool verbose)
 {
+    QFile out(fileName);
+    if (!out.open(QIODevice::WriteOnly))
+    {
+        cout << "Could not write file '" << fileName << "'" << endl;
+        return false;
+    }
+    QElapsedTimer t;
+    t.start();
+    port->readAvailable();
+    HexWriter writer(&out, recordBytes);
+    const bool ok = port->readEeprom(start, length, window, writer);
+    // Terminate the file even if only part of the EEPROM was read
+    if (!writer.finish())
+    {
+        cout << "Could not write file '" << fileName << "'" << endl;
+        return false;
+    }
+    if (ok && verbose)
+        cout << "Read " << length << " bytes of EEPROM in " << t.elapsed() << " ms" << endl;
+    return ok;
+}
+
+/// Settings for program()
+struct ProgramOptions
+{
+    ProgramOptions()
+        : delay(0),
+          window(1),
+          recordBytes(HexFile::DefaultRecordBytes),
+          pageSize(0),
+          pageWriteUs(0),
+          skipErased(false)
+    {
+    }
+
+    /// Fixed delay between records (0: adaptive)
+    int delay;
+    /// Number of records in flight
+    int window;
+    /// Number of data bytes per record
+    int recordBytes;
+    /// Flash page size (0: Don't align records to pages)
+    int pageSize;
+    /// Expected page write time in us (0: unknown)
+    int pageWriteUs;
+    /// Don't send pages that contain only 0xFF
+    bool skipErased;
+    /// Start addresses of flash pages that the device already holds
+    QSet<quint32> unchangedPages;
+};
+
+bool program(const HexFile& hexFile, C45BPort* port, const ProgramOptions& options, bool doFlash, bool verbose)
+{
+    HexChunker chunker(options.recordBytes, doFlash ? options.pageSize : 0);
+    chunker.setSkipErased(doFlash && options.skipErased);
+    if (doFlash)
+        chunker.setUnchangedPages(options.unchangedPages);
+    ChunkStats chunkStats;
+    const QList<HexChunk> chunks = chunker.chunk(hexFile, &chunkStats);
+    if (verbose && (chunker.pageSize() > 0))
+    {
+        const int pages = HexChunker::pageCount(chunks);
+        cout << pages << " page commits, " << (pages ? chunks.size()/pages : 0) << " records per page" << endl;
+    }
+    if (doFlash && options.skipErased)
+        cout << "Skipping " << chunkStats.skippedPages << " erased pages ("
+             << chunkStats.skippedBytes << " bytes)" << endl;
+    if (doFlash && !options.unchangedPages.isEmpty())
+        cout << "Skipping " << chunkStats.unchangedPages << " unchanged pages ("
+             << chunkStats.unchangedBytes << " bytes)" << endl;
+    // Encode all records up front, so nothing is converted while sending
+    const FlashPlan plan(hexFile, chunks);
+
     QString cmd(doFlash ? "pf" : "pe");
     port->write(cmd.toLatin1().data(), cmd.size());
     port->putChar('\n');
@@ -154,23 +272,50 @@ bool program(const HexFile& hexFile, C45BSerialPort* port, int delay, bool doFla
     if (verbose)
         cout << "Programming " << (doFlash ? "flash" : "EEPROM") << " memory..." << flush;
 
-    port->readAll();
-
-    QStringList hexFileLines = hexFile.getHexFile();
+    port->readAvailable();
+    port->resetStats();
+    // Flash and EEPROM have different timing, so learn them separately
+    port->pacing().reset();
+    port->pacing().setFixedDelay(options.delay);
+    if (doFlash && (options.pageWriteUs > 0))
+        port->pacing().seedPageLatency(options.pageWriteUs);
+
+    // Without pages, a resent flash record would land in a page buffer that the
+    // bootloader has filled with 0xFF, wiping the records before it
+    const int retryLimit = port->retryLimit();
+    if (doFlash && (chunker.pageSize() <= 0))
+    {
+        if (verbose && retryLimit)
+            cout << "No page size, so flash records are not resent" << endl;
+        port->setRetryLimit(0);
+    }
     quint32 lineNr = 0;
-    foreach(QString line, hexFileLines)
+    bool ok = true;
+    if (((options.window > 1) || (options.window == C45BPort::AutoWindow)) && (options.delay <= 0))
+    {
+        // Pipelined download
+        ok = port->downloadLines(plan, options.window, lineNr);
+    }
+    else
     {
-        ++lineNr;
-        if (!port->downloadLine(line))
+        // Stop-and-wait
+        for (int i = 0; ok && (i < plan.recordCount()); ++i)
         {
-            cout << "Error: Failed to download line " << lineNr << endl;
-            return false;
+            ++lineNr;
+            ok = port->downloadRecord(plan, i);
         }
-        if(delay > 0)
-            Msleep(delay);
+    }
+    port->setRetryLimit(retryLimit);
+    if (!ok)
+    {
+        cout << "Error: Failed to download line " << lineNr << endl;
+        return false;
     }
 
-    QByteArray received = port->readAll();
+    if (port->stats().retries)
+        cout << "Resent records " << port->stats().retries << " times" << endl;
+
+    QByteArray received = port->readAvailable();
 
     if (received.contains('-'))
     {
@@ -179,64 +324,147 @@ bool program(const HexFile& hexFile, C45BSerialPort* port, int delay, bool doFla
         return false;
     }
     if (verbose)
+    {
         cout << "...done" << endl;
+        const TransferStats& stats = port->stats();
+        cout << "Sent " << stats.records << " records: "
+             << stats.transmitNs/1000000 << " ms transmitting, "
+             << stats.waitNs/1000000 << " ms waiting for acknowledgement, "
+             << stats.delayNs/1000000 << " ms pacing" << endl;
+        if (stats.records)
+            cout << "Per record: " << stats.transmitNs/1000/stats.records << " us transmitting, "
+                 << stats.waitNs/1000/stats.records << " us waiting" << endl;
+        const PacingController& pacing = port->pacing();
+        if ((options.window == C45BPort::AutoWindow) && (pacing.replyInterval() > 0))
+            cout << "Window: " << pacing.window(C45BPort::MaxWindow) << " records (round trip "
+                 << pacing.minRoundTrip() << " us, " << pacing.replyInterval() << " us per record)" << endl;
+        if (pacing.recordLatency() >= 0)
+        {
+            cout << "Acknowledgement latency: " << pacing.recordLatency() << " us per record";
+            if (pacing.pageLatency() >= 0)
+                cout << ", " << pacing.pageLatency() << " us per page write";
+            cout << endl;
+        }
+    }
 
     return true;
 }
 
-bool connectBootloader(C45BSerialPort* port, bool debug, bool verbose)
+// How many ms to wait for bootloader prompt
+const int InitialTimeOut = 60000;
+
+// How long (ms) the bootloader listens for 'U' after a reset
+const int BootloaderListenTime = 2000;
+
+// How long (ms) to let the device start up after a reset before sending 'U'
+const int ResetSettleTime = 100;
+
+/// Settings for connectBootloader()
+struct ConnectOptions
 {
-    // How many ms to wait for bootloader prompt
-    const int InitialTimeOut = 60000;
+    ConnectOptions()
+        : timeout(InitialTimeOut),
+          syncInterval(100),
+          settleTime(100),
+          resetLines(C45BPort::ResetNone),
+          resetActiveHigh(true),
+          resetPulse(50)
+    {
+    }
 
-    QTime t;
+    /// How many ms to wait for the bootloader prompt
+    int timeout;
+    /// How many ms between 'U' bursts
+    int syncInterval;
+    /// How many ms to wait for the bootloader to settle after connecting
+    int settleTime;
+    /// Lines to pulse to reset the device (C45BPort::ResetLine values)
+    int resetLines;
+    /// True if the device is held in reset while the lines are asserted
+    bool resetActiveHigh;
+    /// Length of the reset pulse in ms
+    int resetPulse;
+};
+
+/// Reset the device through the modem control lines, if configured,
+/// and wait for it to start the bootloader.
+void resetDevice(C45BPort* port, const ConnectOptions& options, bool debug)
+{
+    if (!options.resetLines)
+        return;
+    if (debug)
+        cout << "Resetting device" << endl;
+    port->pulseReset(options.resetLines, options.resetActiveHigh, options.resetPulse);
+    Msleep(ResetSettleTime);
+    // Discard anything the application sent while being reset
+    port->readAvailable();
+}
+
+bool connectBootloader(C45BPort* port, const ConnectOptions& options, bool debug, bool verbose)
+{
+    // "After a reset the bootloader waits for approximately 2 seconds to detect a
+    //  transmission at its RXD pin. If so, it will measure the timing of the rising
+    //  and falling edges of four consecutive characters 'U' at the host's baud to
+    //  determine its correct baud rate prescaler."
+    static const char syncBurst[] = "UUUU\n";
+
+    QElapsedTimer t;
     t.start();
-    QTime t2;
+    QElapsedTimer t2;
     t2.start();
-    int avail = 0;
+
+    resetDevice(port, options, debug);
+    QElapsedTimer sinceReset;
+    sinceReset.start();
+    QElapsedTimer sinceBurst;
 
     QString prompt;
     bool connected = false;
     bool gotActiveBootloader = false;
-    while (!connected && (t.elapsed() < InitialTimeOut))
+    while (!connected && (t.elapsed() < options.timeout))
     {
-        // "After a reset the bootloader waits for approximately 2 seconds to detect a
-        //  transmission at its RXD pin. If so, it will measure the timing of the rising
-        //  and falling edges of four consecutive characters 'U' at the host's baud to
-        //  determine its correct baud rate prescaler."
+        if (options.resetLines && (sinceReset.elapsed() > BootloaderListenTime))
+        {
+            // Missed the window, so try again
+            resetDevice(port, options, debug);
+            sinceReset.start();
+            sinceBurst.invalidate();
+        }
 
-        port->putChar('U');
-        port->putChar('U');
-        port->putChar('U');
-        port->putChar('U');
-        port->putChar('\n');
-        port->flush();
+        if (!sinceBurst.isValid() || (sinceBurst.elapsed() >= options.syncInterval))
+        {
+            port->write(syncBurst, sizeof(syncBurst) - 1);
+            port->flush();
+            sinceBurst.start();
+        }
 
-        Msleep(100);
         if (verbose && (t2.elapsed() > 1000))
         {
             cout << "." << flush;
             t2.start();
         }
-        avail = port->bytesAvailable();
-        if(avail)
+
+        // Wait for a reply until the next burst is due
+        const int wait = qMin(options.syncInterval - static_cast<int>(sinceBurst.elapsed()),
+                              options.timeout - static_cast<int>(t.elapsed()));
+        if (!port->waitForData(qMax(wait, 0)))
+            continue;
+        prompt = port->readUntil(C45BPort::XON, 30, 200);
+        if (prompt.contains("c45b2"))
         {
-            prompt = port->readUntil(C45BSerialPort::XON, 30);
-            if (prompt.contains("c45b2"))
-            {
-                connected = true;
-                if(debug)
-                    cout << "Found fresh bootloader" << endl;
-            }
-            else if (prompt.contains(QString("%1-\n\r>").arg(QChar(C45BSerialPort::XOFF))))
-            {
-                connected = true;
-                gotActiveBootloader = true;
-                if(debug)
-                    cout << "Found already activated bootloader" << endl;
-            }
+            connected = true;
+            if(debug)
+                cout << "Found fresh bootloader" << endl;
+        }
+        else if (prompt.contains(QString("%1-\n\r>").arg(QChar(C45BPort::XOFF))))
+        {
+            connected = true;
+            gotActiveBootloader = true;
+            if(debug)
+                cout << "Found already activated bootloader" << endl;
         }
     }
+    const qint64 timeToPrompt = options.resetLines ? sinceReset.elapsed() : t.elapsed();
 
     if (debug)
         cout << "Read " << prompt.size() << " bytes: " << FormatControlChars(prompt).toStdString() << endl;
@@ -259,23 +487,84 @@ bool connectBootloader(C45BSerialPort* port, bool debug, bool verbose)
     else if (verbose)
         cout << "Bootloader " << prompt.mid(5).simplified() << endl;
 
-    // Flush
-    port->readAll();
-    Msleep(10);
+    if (verbose)
+        cout << "Got prompt after " << timeToPrompt << " ms"
+             << (options.resetLines ? " (from reset)" : "") << endl;
 
+    // Flush: Send an empty line and discard everything up to the next prompt
+    port->readAvailable();
     port->putChar('\n');
-    Msleep(100);
-    port->readAll();
+    port->readUntil('>', 64, options.settleTime);
+    port->readAvailable();
     return true;
 }
 
 
+// How many times to measure the round trip for -w auto
+const int RoundTripSamples = 5;
+
+// Baud rates tried by -b auto, fastest first
+const int AutoBaudRates[] = { 230400, 115200, 76800, 57600, 38400, 19200, 9600 };
+
+// How many ms to wait for the bootloader prompt at each rate
+const int AutoBaudTimeOut = 5000;
+
+/// Return device in a form that can be part of a settings key.
+QString settingsName(const QString& device)
+{
+    QString name = device;
+    return name.replace('/', '_').replace('\\', '_');
+}
+
+/// Find the fastest baud rate at which the bootloader answers, and connect at that rate.
+/// Start from the rate that worked last time for settingsKey and step down from there.
+/// Return the rate, or 0 if none worked.
+int negotiateBaud(C45BPort* port, const QString& settingsKey, int maxBaud,
+                  const ConnectOptions& connectOptions, bool debug, bool verbose)
+{
+    ConnectOptions options = connectOptions;
+    options.timeout = AutoBaudTimeOut;
+    QSettings settings("bullestock.net", "c45b");
+    int start = settings.value(settingsKey, 0).toInt();
+    if ((start <= 0) || (maxBaud && (start > maxBaud)))
+        start = maxBaud ? maxBaud : AutoBaudRates[0];
+    QList<int> rates;
+    rates.append(start);
+    for (unsigned int i = 0; i < sizeof(AutoBaudRates)/sizeof(AutoBaudRates[0]); ++i)
+        if (AutoBaudRates[i] < start)
+            rates.append(AutoBaudRates[i]);
+
+    foreach (int rate, rates)
+    {
+        if (verbose)
+            cout << "Trying " << rate << " baud..." << flush;
+        if (!port->setBaudRate(rate))
+            continue;
+        port->readAvailable();
+        // A prompt can be garbled into something plausible, so also do a real exchange
+        QByteArray trial;
+        if (connectBootloader(port, options, debug, verbose) && port->readEeprom(0, 1, 1, trial))
+        {
+            settings.setValue(settingsKey, rate);
+            if (verbose)
+                cout << "Using " << rate << " baud" << endl;
+            return rate;
+        }
+    }
+    cout << "Error: No working baud rate found" << endl;
+    return 0;
+}
+
 int main(int argc, char** argv)
 {
+    QElapsedTimer startup;
+    startup.start();
+
     // Suppress qDebug output from QSerialPort
     qInstallMessageHandler(SilentMsgHandler);
-    
-    QCoreApplication app(argc, argv);
+
+    // Only created when a Qt class needs it, as it adds to the startup time
+    QCoreApplication* app = 0;
 
     ez::ezOptionParser opt;
 
@@ -292,15 +581,86 @@ int main(int argc, char** argv)
 #ifdef WIN32
             " (without colon)"
 #endif
-            , "-p", "--port");
-    opt.add("", false, 1, 0, "Baud rate",                                    "-b", "--baud");
+            ". Also tcp://host:port for a raw TCP connection, "
+            "pty:path for a pseudo-terminal, or loop[:part] for a "
+            "simulated bootloader", "-p", "--port");
+    opt.add("", false, 1, 0, "How to access serial ports: qt (QSerialPort) "
+                             "or native (termios, POSIX only). "
+#ifdef C45B_NATIVE_SERIAL
+                             "This build only supports native.",             "--backend");
+#else
+                             "Default: qt.",                                 "--backend");
+#endif
+    opt.add("", false, 1, 0, "Baud rate, or 'auto' to use the fastest rate "
+                             "that works, starting from the last rate that "
+                             "worked with this port and part. Each attempt "
+                             "needs the bootloader to be restarted.",        "-b", "--baud");
+    opt.add("", false, 1, 0, "Target part, e.g. atmega328p. Sets the page "
+                             "size and checks that the files fit the "
+                             "device.",                                      "--part");
+    opt.add("", false, 1, 0, "INI file with additional part definitions. "
+                             "Each part is a group with the keys flash, "
+                             "pagesize, bootstart, eeprom, maxbaud and "
+                             "pagewrite (in us).",                           "--partfile");
     opt.add("", false, 1, 0, "Program flash memory file",                    "-f", "--flash");
     opt.add("", false, 1, 0, "Program EEPROM file",                          "-e", "--eeprom");
     opt.add("", false, 1, 0, "Delay (in ms) to wait between sending "
                              "two lines of EEPROM data.\n"
+                             "By default the delay adapts to the device. "
                              "Set or increase this if writing EEPROM fails.","-ed", "--eepromdelay");
-    opt.add("", false, 2,',',"Read EEPROM from device\n"
-                             "Usage: -er destination.hex,length_in_bytes\n", "-er", "--eepromread");
+    opt.add("", false, 0, 0, "Read the device EEPROM first, and only program "
+                             "the bytes that differ from the EEPROM file.", "-ec", "--eepromcompare");
+    opt.add("1", false, 1, 0, "Number of hex records to send ahead of the "
+                             "bootloader's replies.\n"
+                             "1 (the default) waits for each record to be "
+                             "acknowledged before sending the next. "
+                             "'auto' sizes the window from the measured "
+                             "round trip time, and is the default for "
+                             "tcp:// ports. "
+                             "Also sets the number of 'er' requests sent "
+                             "ahead when reading EEPROM. "
+                             "Ignored when -ed is set.",                     "-w", "--window");
+    opt.add("3", false, 1, 0, "How many times to resend a hex record after "
+                             "a bad or missing reply before giving up.",     "--retries");
+    opt.add("16", false, 1, 0, "Number of data bytes per hex record sent to "
+                             "the bootloader or written to a file (1-32).",  "-rw", "--recordwidth");
+    opt.add("", false, 1, 0, "Flash page size of the device in bytes.\n"
+                             "If set, flash records are aligned to page "
+                             "boundaries.",                                  "-ps", "--pagesize");
+    opt.add("", false, 0, 0, "Don't send flash pages that contain only 0xFF.\n"
+                             "Only use this if the flash has been erased. "
+                             "Requires -ps.",                                "-se", "--skiperased");
+    opt.add("", false, 0, 0, "Continue an interrupted flash download of the "
+                             "same image on the same port, from the first "
+                             "page that was not written. Requires -ps.",     "--resume");
+    opt.add("", false, 0, 0, "Only send the flash pages that differ from the "
+                             "last image successfully downloaded to this "
+                             "device. The page hashes are kept in a cache "
+                             "file per port and serial number. "
+                             "Requires -ps, and -sn or -sa.",                "-pc", "--pagecache");
+    opt.add("", false, 1, 0, "Serial number of the device, used with -pc.",   "-sn", "--serial");
+    opt.add("", false, 2,',',"Read the serial number of the device from "
+                             "EEPROM, for use with -pc.\n"
+                             "Usage: -sa start,length",                      "-sa", "--serialaddress");
+    opt.add("", false, -1,',',"Read EEPROM from device\n"
+                             "Usage: -er destination.hex,[start,]length\n"
+                             "start and length are in bytes, and may be "
+                             "given in hex with a 0x prefix. "
+                             "Records are written as they are read.",       "-er", "--eepromread");
+    opt.add("", false, 1, 0, "Reset the device into the bootloader by "
+                             "pulsing a modem control line: dtr, rts or "
+                             "both. The device is reset again if the "
+                             "bootloader does not answer within its "
+                             "listen window.",                               "--reset");
+    opt.add("60000", false, 1, 0, "How long (in ms) to wait for the "
+                             "bootloader prompt.",                           "--connecttimeout");
+    opt.add("100", false, 1, 0, "Interval (in ms) between the 'U' bursts sent "
+                             "while waiting for the bootloader.",            "--syncinterval");
+    opt.add("100", false, 1, 0, "How long (in ms) to wait for the bootloader "
+                             "to settle after connecting.",                  "--settle");
+    opt.add("high", false, 1, 0, "Level that resets the device: high (the "
+                             "line is asserted, the default) or low.",      "--resetlevel");
+    opt.add("50", false, 1, 0, "Length of the reset pulse in ms.",           "--resetpulse");
     opt.add("", false, 0, 0, "Start application/leave bootloader on exit", "-r", "--runapp");
     opt.add("", false, 0, 0, "Show debug info",                              "-d", "--debug");
     opt.add("", false, 0, 0, "Be verbose",                                   "--verbose");
@@ -314,6 +674,12 @@ int main(int argc, char** argv)
                              "The following escape sequences may be used:\n"
                              "\\\\ \\t \\n \\r ",                            "-c", "--appcmd");
     opt.add("", false, 1, 0, "Executes the hexfile implementation test with given file", "--testhex");
+    opt.add("", false, 1, 0, "Measure hex decoding and encoding speed using the records in the given file", "--benchhex");
+    opt.add("", false, 1, 0, "Serve a simulated bootloader on the given TCP "
+                             "port on 127.0.0.1, for testing with "
+                             "-p tcp://127.0.0.1:port. The part is set by "
+                             "--part, and -b sets the speed of the simulated "
+                             "serial line.",                                 "--simserver");
     opt.add("", false, 2,',',"Read the input hex file and write a "
                              "reformatted output hex file.\n"
                              "Usage: --reformathex input,output",            "--reformathex");
@@ -337,6 +703,57 @@ int main(int argc, char** argv)
         return 1;
     }
 
+    int recordBytes = HexFile::DefaultRecordBytes;
+    opt.get("-rw")->getInt(recordBytes);
+    if ((recordBytes < 1) || (recordBytes > HexFile::MaxRecordBytes))
+    {
+        cout << "Record width must be between 1 and " << HexFile::MaxRecordBytes << endl;
+        return 1;
+    }
+
+    if (opt.isSet("--simserver"))
+    {
+        int serverPort = 0;
+        opt.get("--simserver")->getInt(serverPort);
+        if ((serverPort < 1) || (serverPort > 65535))
+        {
+            cout << "Invalid TCP port " << serverPort << endl;
+            return 1;
+        }
+        DeviceProfiles profiles;
+        if (opt.isSet("--partfile"))
+        {
+            std::string fileName;
+            opt.get("--partfile")->getString(fileName);
+            if (!profiles.load(QString::fromStdString(fileName)))
+            {
+                cout << "Failed to load part file: " << profiles.errorString() << endl;
+                return 1;
+            }
+        }
+        std::string name = DefaultSimulatedPart;
+        if (opt.isSet("--part"))
+            opt.get("--part")->getString(name);
+        const DeviceProfile* profile = profiles.find(QString::fromStdString(name));
+        if (!profile)
+        {
+            cout << "Unknown part '" << name << "'. Known parts: " << profiles.names().join(", ") << endl;
+            return 1;
+        }
+        int baudRate = 0;
+        opt.get("-b")->getInt(baudRate);
+        app = new QCoreApplication(argc, argv);
+        SimServer server(*profile, baudRate);
+        if (!server.listen(static_cast<quint16>(serverPort)))
+        {
+            cout << "Error: Cannot listen on port " << serverPort << ": " << server.errorString() << endl;
+            return 1;
+        }
+        cout << "Simulating " << profile->name << " on tcp://127.0.0.1:" << server.port() << endl;
+        server.run(verbose);
+        cout << "Error: " << server.errorString() << endl;
+        return 1;
+    }
     if (opt.isSet("--testhex"))  // check hexfiles prior to doing COM stuff
     {
         std::string fileName;
@@ -345,6 +762,14 @@ int main(int argc, char** argv)
         tester.test(QString::fromStdString(fileName));
         return 0;
     }
+    if (opt.isSet("--benchhex"))
+    {
+        std::string fileName;
+        opt.get("--benchhex")->getString(fileName);
+        HexFileTester tester;
+        tester.benchmark(QString::fromStdString(fileName));
+        return 0;
+    }
     if(opt.isSet("--reformathex"))
     {
         std::vector<std::string> str;
@@ -357,7 +782,7 @@ int main(int argc, char** argv)
             cout << "Failed to load file '" << infile << "': " << hex.errorString() << endl;
             return 1;
         }
-        if (!writeHexfile(outfile, hex))
+        if (!writeHexfile(outfile, hex, recordBytes))
         {
             cout << "Failed to write file '" << outfile << "' " << endl;
             return 1;
@@ -407,7 +832,34 @@ int main(int argc, char** argv)
         return 1;
     }
 
+    DeviceProfiles profiles;
+    if (opt.isSet("--partfile"))
+    {
+        std::string fileName;
+        opt.get("--partfile")->getString(fileName);
+        if (!profiles.load(QString::fromStdString(fileName)))
+        {
+            cout << "Failed to load part file: " << profiles.errorString() << endl;
+            return 1;
+        }
+    }
+    const DeviceProfile* profile = 0;
+    if (opt.isSet("--part"))
+    {
+        std::string name;
+        opt.get("--part")->getString(name);
+        profile = profiles.find(QString::fromStdString(name));
+        if (!profile)
+        {
+            cout << "Unknown part '" << name << "'. Known parts: " << profiles.names().join(", ") << endl;
+            return 1;
+        }
+    }
+
     HexFile flashHexFile;
+    // Don't let the application overwrite the bootloader
+    if (profile)
+        flashHexFile.setMaxSize(profile->bootStart);
     if (doFlash)  // check hexfiles prior to doing COM stuff
     {
         std::string fileName;
@@ -419,8 +871,88 @@ int main(int argc, char** argv)
         }
     }
 
-    int eepromWriteDelay = 0;
+    ProgramOptions programOptions;
+    std::string windowOption;
+    opt.get("-w")->getString(windowOption);
+    if (windowOption == "auto")
+        programOptions.window = C45BPort::AutoWindow;
+    else
+    {
+        opt.get("-w")->getInt(programOptions.window);
+        if (programOptions.window < 1)
+        {
+            cout << "Window size must be at least 1 or 'auto'" << endl;
+            return 1;
+        }
+    }
+    programOptions.recordBytes = recordBytes;
+    if (profile && !opt.isSet("-ps"))
+        programOptions.pageSize = profile->pageSize;
+    else
+        opt.get("-ps")->getInt(programOptions.pageSize);
+    if (profile && (programOptions.pageSize != profile->pageSize))
+        cout << "Warning: Page size " << programOptions.pageSize << " differs from the "
+             << profile->pageSize << " bytes of " << profile->name << endl;
+    if (profile)
+        programOptions.pageWriteUs = profile->pageWriteUs;
+    if ((programOptions.pageSize < 0) || (programOptions.pageSize & (programOptions.pageSize - 1)))
+    {
+        cout << "Page size must be a power of two" << endl;
+        return 1;
+    }
+    programOptions.skipErased = opt.isSet("-se");
+    if (programOptions.skipErased && !programOptions.pageSize)
+    {
+        cout << "-se requires the page size to be specified" << endl;
+        return 1;
+    }
+
+    const bool resume = doFlash && opt.isSet("--resume");
+    if (resume && !programOptions.pageSize)
+    {
+        cout << "--resume requires the page size to be specified" << endl;
+        return 1;
+    }
+    const bool usePageCache = doFlash && opt.isSet("-pc");
+    QString serial;
+    quint32 serialStart = 0;
+    quint32 serialBytes = 0;
+    if (usePageCache)
+    {
+        if (!programOptions.pageSize)
+        {
+            cout << "-pc requires the page size to be specified" << endl;
+            return 1;
+        }
+        if (opt.isSet("-sn"))
+        {
+            std::string str;
+            opt.get("-sn")->getString(str);
+            serial = QString::fromStdString(str);
+        }
+        else if (opt.isSet("-sa"))
+        {
+            std::vector<std::string> str;
+            opt.get("-sa")->getStrings(str);
+            if ((str.size() != 2) || !parseNumber(str[0], serialStart) || !parseNumber(str[1], serialBytes) ||
+                !serialBytes || (serialStart > 0x10000) || (serialBytes > 0x10000 - serialStart))
+            {
+                cout << "Usage: -sa start,length" << endl;
+                return 1;
+            }
+        }
+        else
+        {
+            cout << "-pc requires -sn or -sa" << endl;
+            return 1;
+        }
+    }
+
+    ProgramOptions eepromOptions = programOptions;
+    eepromOptions.pageSize = 0;
     HexFile eepHexFile;
+    if (profile)
+        eepHexFile.setMaxSize(profile->eepromBytes);
     if (doEeprom)  // check hexfiles prior to doing COM stuff
     {
         std::string fileName;
@@ -431,22 +963,45 @@ int main(int argc, char** argv)
             return 1;
         }
         if (opt.isSet("-ed"))
-            opt.get("-ed")->getInt(eepromWriteDelay);
+            opt.get("-ed")->getInt(eepromOptions.delay);
     }
 
     QString eepromReadFilename;
+    quint32 eepromReadStart = 0;
     quint32 eepromReadBytes = 0;
     if (doEepromRead)
     {
         std::vector<std::string> str;
         opt.get("-er")->getStrings(str);
+        if ((str.size() < 2) || (str.size() > 3))
+        {
+            cout << "Usage: -er destination.hex,[start,]length" << endl;
+            return 1;
+        }
         eepromReadFilename = QString::fromStdString(str[0]);
-        QString bytes(str[1].c_str());
-        bool correctNumber;
-        eepromReadBytes = bytes.toUInt(&correctNumber);
-        if (!correctNumber)
+        if (str.size() == 3)
+        {
+            if (!parseNumber(str[1], eepromReadStart))
+            {
+                cout << str[1] << " is not a valid number" << endl;
+                return 1;
+            }
+        }
+        if (!parseNumber(str.back(), eepromReadBytes))
         {
-            cout << bytes.toLocal8Bit().data() << " is not a valid number"<<endl;
+            cout << str.back() << " is not a valid number" << endl;
+            return 1;
+        }
+        // The 'er' command takes a 16 bit address. Check the length against what is
+        // left, as the sum can wrap around.
+        if ((eepromReadStart > 0x10000) || (eepromReadBytes > 0x10000 - eepromReadStart))
+        {
+            cout << "EEPROM range exceeds 64 KB" << endl;
+            return 1;
+        }
+        if (profile && (eepromReadStart + eepromReadBytes > profile->eepromBytes))
+        {
+            cout << "EEPROM range exceeds the " << profile->eepromBytes << " bytes of " << profile->name << endl;
             return 1;
         }
     }
@@ -464,18 +1019,105 @@ int main(int argc, char** argv)
     }
 
 
+    int retryLimit = C45BPort::DefaultRetryLimit;
+    opt.get("--retries")->getInt(retryLimit);
+    if (retryLimit < 0)
+    {
+        cout << "Retry count must not be negative" << endl;
+        return 1;
+    }
+
+    ConnectOptions connectOptions;
+    opt.get("--connecttimeout")->getInt(connectOptions.timeout);
+    opt.get("--syncinterval")->getInt(connectOptions.syncInterval);
+    opt.get("--settle")->getInt(connectOptions.settleTime);
+    if ((connectOptions.timeout < 1) || (connectOptions.syncInterval < 1) || (connectOptions.settleTime < 0))
+    {
+        cout << "Invalid connect timing" << endl;
+        return 1;
+    }
+    if (opt.isSet("--reset"))
+    {
+        std::string line;
+        opt.get("--reset")->getString(line);
+        if (line == "dtr")
+            connectOptions.resetLines = C45BPort::ResetDtr;
+        else if (line == "rts")
+            connectOptions.resetLines = C45BPort::ResetRts;
+        else if (line == "both")
+            connectOptions.resetLines = C45BPort::ResetDtr | C45BPort::ResetRts;
+        else
+        {
+            cout << "Reset line must be dtr, rts or both" << endl;
+            return 1;
+        }
+        std::string level;
+        opt.get("--resetlevel")->getString(level);
+        if ((level != "high") && (level != "low"))
+        {
+            cout << "Reset level must be high or low" << endl;
+            return 1;
+        }
+        connectOptions.resetActiveHigh = (level == "high");
+        opt.get("--resetpulse")->getInt(connectOptions.resetPulse);
+        if (connectOptions.resetPulse < 1)
+        {
+            cout << "Reset pulse must be at least 1 ms" << endl;
+            return 1;
+        }
+    }
+
     string s;
     opt.get("-p")->getString(s);
     QString device = s.c_str();
 
-    C45BSerialPort* port = new C45BSerialPort(device, verbose);
+    if (!opt.isSet("-w") && device.startsWith("tcp://"))
+        // Every record would wait for a network round trip
+        programOptions.window = C45BPort::AutoWindow;
+
+    Transport::SerialBackend backend = Transport::defaultBackend();
+    if (opt.isSet("--backend"))
+    {
+        std::string name;
+        opt.get("--backend")->getString(name);
+        if (name == "qt")
+            backend = Transport::QtBackend;
+        else if (name == "native")
+            backend = Transport::NativeBackend;
+        else
+        {
+            cout << "Backend must be qt or native" << endl;
+            return 1;
+        }
+    }
+
+    QString transportError;
+    Transport* transport = Transport::create(device, profiles, backend, transportError);
+    if (!transport)
+    {
+        cout << "Error: " << transportError << endl;
+        return 1;
+    }
+    if (transport->needsApplication() && !app)
+        app = new QCoreApplication(argc, argv);
+    C45BPort* port = new C45BPort(transport, verbose);
+    port->setRetryLimit(retryLimit);
+    std::string baudOption;
+    opt.get("-b")->getString(baudOption);
+    const bool autoBaud = (baudOption == "auto");
     int baudRate = 0;
-    opt.get("-b")->getInt(baudRate);
+    if (!autoBaud)
+        opt.get("-b")->getInt(baudRate);
+    if (profile && (baudRate > profile->maxBaud))
+        cout << "Warning: " << baudRate << " baud is above the " << profile->maxBaud
+             << " baud known to work with " << profile->name << endl;
     if (!port->init(baudRate))
     {
-        cout << "Error: Cannot open port '" << device << "': " << strerror(errno) << endl;
+        cout << "Error: Cannot open port '" << device << "': " << port->errorString() << endl;
         return 1;
     }
+    if (verbose)
+        cout << "Port open after " << startup.elapsed() << " ms" << endl;
 
     if (sendAppCmd)
     {
@@ -487,27 +1129,127 @@ int main(int argc, char** argv)
     if (verbose)
         cout << "Connecting..." << flush;
 
-    if (!connectBootloader(port, debug, verbose))
+    if (autoBaud)
+    {
+        // Remember the rate per port and part
+        const QString key = QString("baud/%1/%2").arg(settingsName(device)).arg(profile ? profile->name : QString("any"));
+        baudRate = negotiateBaud(port, key, profile ? profile->maxBaud : 0, connectOptions, debug, verbose);
+        if (!baudRate)
+            return 1;
+    }
+    else if (!connectBootloader(port, connectOptions, debug, verbose))
         return 1;
 
+    if (programOptions.window == C45BPort::AutoWindow)
+    {
+        const qint64 roundTrip = port->measureRoundTrip(RoundTripSamples);
+        if (verbose && (roundTrip >= 0))
+            cout << "Round trip " << roundTrip << " us" << endl;
+    }
+
     if(doFlash)
     {
-        if (!program(flashHexFile, port, 0, true, verbose))
+        QScopedPointer<PageCache> pageCache;
+        if (usePageCache)
+        {
+            if (serial.isEmpty())
+            {
+                QByteArray id;
+                port->readAvailable();
+                if (!port->readEeprom(serialStart, serialBytes, programOptions.window, id))
+                    return 1;
+                serial = QString::fromLatin1(id.toHex());
+                if (verbose)
+                    cout << "Device serial number: " << serial << endl;
+            }
+            pageCache.reset(new PageCache(device + " " + serial, programOptions.pageSize));
+            if (pageCache->load())
+                programOptions.unchangedPages = pageCache->unchangedPages(flashHexFile);
+            else
+                cout << pageCache->errorString() << ", sending all pages" << endl;
+            // If the download fails, the device contents are unknown
+            if (!pageCache->invalidate())
+            {
+                cout << "Error: " << pageCache->errorString() << endl;
+                return 1;
+            }
+        }
+        QScopedPointer<FlashCheckpoint> checkpoint;
+        if (programOptions.pageSize)
+        {
+            checkpoint.reset(new FlashCheckpoint(device, flashHexFile, programOptions.pageSize));
+            if (resume)
+            {
+                if (checkpoint->load())
+                {
+                    const QSet<quint32> committed = checkpoint->committedPages();
+                    cout << "Resuming: " << committed.size() << " pages already written" << endl;
+                    programOptions.unchangedPages.unite(committed);
+                }
+                else
+                    cout << checkpoint->errorString() << ", sending all pages" << endl;
+            }
+            if (checkpoint->begin())
+                port->setObserver(checkpoint.data());
+            else
+                cout << "Warning: " << checkpoint->errorString() << endl;
+        }
+        const bool flashed = program(flashHexFile, port, programOptions, true, verbose);
+        port->setObserver(0);
+        // After a failure the checkpoint is kept for --resume
+        if (!flashed)
             return 1;
+        if (checkpoint)
+            checkpoint->finish();
+        if (pageCache && !pageCache->save(flashHexFile))
+            cout << "Warning: " << pageCache->errorString() << endl;
     }
 
     if (doEeprom)
     {
-        if(!program(eepHexFile, port, eepromWriteDelay, false, verbose))
+        if (opt.isSet("-ec"))
+        {
+            QElapsedTimer t;
+            t.start();
+            HexFile changed;
+            if (!diffEeprom(eepHexFile, port, programOptions.window, changed, verbose))
+                return 1;
+            const qint64 readMs = t.elapsed();
+            const quint32 skipped = eepHexFile.byteCount() - changed.byteCount();
+            // Time (in ns) per byte of the last EEPROM write through this port at this rate
+            QSettings settings("bullestock.net", "c45b");
+            const QString byteTimeKey = QString("eepromwrite/%1/%2").arg(settingsName(device))
+                                        .arg(baudRate ? QString::number(baudRate) : QString("default"));
+            if (changed.ranges().isEmpty())
+            {
+                const qint64 byteNs = settings.value(byteTimeKey, 0).toLongLong();
+                cout << "EEPROM is up to date (" << skipped << " bytes skipped";
+                if (byteNs > 0)
+                    cout << ", saving about " << qMax<qint64>(byteNs*skipped/1000000 - readMs, 0) << " ms";
+                cout << ")" << endl;
+            }
+            else
+            {
+                if(!program(changed, port, eepromOptions, false, verbose))
+                    return 1;
+                // Estimate the time for a full write from the time spent per byte now
+                const TransferStats& stats = port->stats();
+                const qint64 writeNs = stats.transmitNs + stats.waitNs + stats.delayNs;
+                settings.setValue(byteTimeKey, writeNs/changed.byteCount());
+                const qint64 savedMs = writeNs*skipped/changed.byteCount()/1000000 - readMs;
+                cout << "Skipped " << skipped << " unchanged EEPROM bytes, saving about "
+                     << qMax<qint64>(savedMs, 0) << " ms" << endl;
+            }
+        }
+        else if(!program(eepHexFile, port, eepromOptions, false, verbose))
             return 1;
     }
 
     if (doEepromRead)
     {
-        HexFile resultHexFile;
-        if (!readEeprom(resultHexFile, eepromReadBytes, port, verbose))
+        if (!readEeprom(eepromReadFilename, eepromReadStart, eepromReadBytes, recordBytes,
+                        port, programOptions.window, verbose))
             return 1;
-        writeHexfile(eepromReadFilename, resultHexFile);
     }
 
     if (runApp)